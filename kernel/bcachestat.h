@@ -0,0 +1,10 @@
+// Buffer cache statistics, from bcachestat().
+struct bcachestat {
+  uint64 hits;         // Lookups that found the block cached
+  uint64 misses;       // Lookups that had to read it
+  int nbuf;            // Buffers in the cache
+  int max;             // Most buffers it may grow to
+  uint grows;          // Pages of buffers added
+  uint shrinks;        // Pages of buffers given back to kalloc
+  uint64 readaheads;   // Blocks read ahead of sequential readers
+};
@@ -1,6 +1,6 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
+// The buffer cache is a hash table of buf structures holding
 // cached copies of disk block contents.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
@@ -22,34 +22,202 @@
 #include "defs.h"
 #include "fs.h"
 #include "buf.h"
+#include "proc.h"
+#include "bcachestat.h"
+
+// The buffers are hashed by (dev, blockno) into NBUFHASH
+// buckets, each with its own lock, so lookups of different
+// blocks don't wait for each other. A buffer whose refcnt
+// drops to 0 is stamped from a clock, and a miss recycles the
+// free buffer with the oldest stamp, wherever it is hashed.
+// Misses are serialized by bcache.lock, so the missing block
+// can't be added twice and only one process at a time holds
+// two bucket locks. Lock order: bcache.lock, the missing
+// block's bucket, the other buckets, kmem.lock.
+//
+// The cache starts with the NBUF buffers in bcache.buf and
+// grows a page of buffers at a time, up to bcache.max, when a
+// miss would otherwise recycle a buffer holding a block. When
+// kalloc() runs out of memory it takes back the pages whose
+// buffers are all unused (bshrink()).
+
+#define BUFPERPAGE (PGSIZE / sizeof(struct buf))
+#define NBUFPAGE ((NBUFMAX - NBUF) / BUFPERPAGE)
+
+struct bucket {
+  struct spinlock lock;
+  struct buf *head;   // buffers of the bucket, through next
+};
 
 struct {
   struct spinlock lock;
   struct buf buf[NBUF];
+  struct bucket bucket[NBUFHASH];
+  uint64 clock;       // stamps buffers as they are released
+  int nbuf;           // buffers, those in buf included
+  int max;            // most buffers to grow to
+  char *page[NBUFPAGE]; // pages of added buffers, or 0
 
-  // Linked list of all buffers, through prev/next.
-  // Sorted by how recently the buffer was used.
-  // head.next is most recent, head.prev is least.
-  struct buf head;
+  // statistics for bcachestat()
+  uint64 hits;
+  uint64 misses;
+  uint grows;
+  uint shrinks;
+  uint64 readaheads;
 } bcache;
 
+#define BUFHASH(dev, blockno) (((dev) * 31 + (blockno)) % NBUFHASH)
+
 void
 binit(void)
 {
   struct buf *b;
+  struct bucket *bk;
 
   initlock(&bcache.lock, "bcache");
+  for(bk = bcache.bucket; bk < bcache.bucket+NBUFHASH; bk++)
+    initlock(&bk->lock, "bcache.bucket");
 
-  // Create linked list of buffers
-  bcache.head.prev = &bcache.head;
-  bcache.head.next = &bcache.head;
+  // all buffers start out free, in bucket 0.
   for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
     initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+    b->next = bcache.bucket[0].head;
+    bcache.bucket[0].head = b;
+  }
+  bcache.nbuf = NBUF;
+  bcache.max = NBUFMAX;
+}
+
+// Find block (dev, blockno) in bk, or return 0.
+// Caller must hold bk->lock.
+static struct buf*
+bfind(struct bucket *bk, uint dev, uint blockno)
+{
+  struct buf *b;
+
+  for(b = bk->head; b != 0; b = b->next){
+    if(b->dev == dev && b->blockno == blockno)
+      return b;
+  }
+  return 0;
+}
+
+// Carve page into buffers: return the first, and put the
+// rest in bk as the first to be recycled. Caller must hold
+// bcache.lock and bk->lock.
+static struct buf*
+bgrow(char *page, struct bucket *bk)
+{
+  struct buf *b = (struct buf*)page;
+  int i;
+
+  for(i = 0; i < NBUFPAGE && bcache.page[i]; i++)
+    ;
+  if(i == NBUFPAGE)
+    panic("bgrow");
+  bcache.page[i] = page;
+  memset(page, 0, PGSIZE);
+  for(i = 0; i < BUFPERPAGE; i++){
+    initsleeplock(&b[i].lock, "buffer");
+    if(i > 0){
+      b[i].next = bk->head;
+      bk->head = &b[i];
+    }
+  }
+  bcache.nbuf += BUFPERPAGE;
+  bcache.grows++;
+  return b;
+}
+
+// Give block (dev, blockno), which isn't in bucket bk, a
+// buffer and return it referenced but unlocked. If another
+// miss brought the block in first, return that buffer. For
+// read-ahead, return 0 instead if the block is cached or
+// there is no free buffer.
+static struct buf*
+bmiss(struct bucket *bk, uint dev, uint blockno, int ahead)
+{
+  struct bucket *vk, *victimk;
+  struct buf *b, *victim, **pp;
+  char *page = 0;
+  int better;
+
+  // a page to grow into, got before taking any locks.
+  if(bcache.nbuf + BUFPERPAGE <= bcache.max)
+    page = kalloc_cache();
+
+  // Look again with misses held off, in case another miss
+  // just brought it in.
+  acquire(&bcache.lock);
+  acquire(&bk->lock);
+  if((b = bfind(bk, dev, blockno)) != 0){
+    if(ahead)
+      b = 0;
+    else
+      b->refcnt++;
+    release(&bk->lock);
+    release(&bcache.lock);
+    if(page)
+      kfree(page);
+    return b;
+  }
+
+  // Recycle the least recently used unused buffer. Only the
+  // bucket holding the best one so far stays locked, so that
+  // it can't be taken from under us.
+  victim = 0;
+  victimk = 0;
+  for(vk = bcache.bucket; vk < bcache.bucket+NBUFHASH; vk++){
+    if(vk != bk)
+      acquire(&vk->lock);
+    better = 0;
+    for(b = vk->head; b != 0; b = b->next){
+      if(b->refcnt == 0 && (victim == 0 || b->lastuse < victim->lastuse)){
+        victim = b;
+        better = 1;
+      }
+    }
+    if(better){
+      if(victimk != 0 && victimk != bk)
+        release(&victimk->lock);
+      victimk = vk;
+    } else if(vk != bk){
+      release(&vk->lock);
+    }
+  }
+
+  if((victim == 0 || victim->valid) && page != 0 && bcache.nbuf + BUFPERPAGE <= bcache.max){
+    // rather than drop a cached block, grow.
+    if(victimk != 0 && victimk != bk)
+      release(&victimk->lock);
+    victim = bgrow(page, bk);
+    page = 0;
+    victim->next = bk->head;
+    bk->head = victim;
+  } else if(victim == 0){
+    if(!ahead)
+      panic("bget: no buffers");
+    release(&bk->lock);
+    release(&bcache.lock);
+    return 0;
+  } else if(victimk != bk){
+    // move it to bk.
+    for(pp = &victimk->head; *pp != victim; pp = &(*pp)->next)
+      ;
+    *pp = victim->next;
+    release(&victimk->lock);
+    victim->next = bk->head;
+    bk->head = victim;
   }
+  victim->dev = dev;
+  victim->blockno = blockno;
+  victim->valid = 0;
+  victim->refcnt = 1;
+  release(&bk->lock);
+  release(&bcache.lock);
+  if(page)
+    kfree(page);
+  return victim;
 }
 
 // Look through buffer cache for block on device dev.
@@ -58,34 +226,24 @@ binit(void)
 static struct buf*
 bget(uint dev, uint blockno)
 {
+  struct bucket *bk = &bcache.bucket[BUFHASH(dev, blockno)];
   struct buf *b;
 
-  acquire(&bcache.lock);
-
   // Is the block already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
-    if(b->dev == dev && b->blockno == blockno){
-      b->refcnt++;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
-    }
+  acquire(&bk->lock);
+  if((b = bfind(bk, dev, blockno)) != 0){
+    b->refcnt++;
+    release(&bk->lock);
+    __sync_fetch_and_add(&bcache.hits, 1);
+    acquiresleep(&b->lock);
+    return b;
   }
+  release(&bk->lock);
+  __sync_fetch_and_add(&bcache.misses, 1);
 
-  // Not cached.
-  // Recycle the least recently used (LRU) unused buffer.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if(b->refcnt == 0) {
-      b->dev = dev;
-      b->blockno = blockno;
-      b->valid = 0;
-      b->refcnt = 1;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
-    }
-  }
-  panic("bget: no buffers");
+  b = bmiss(bk, dev, blockno, 0);
+  acquiresleep(&b->lock);
+  return b;
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -102,6 +260,62 @@ bread(uint dev, uint blockno)
   return b;
 }
 
+// Return a locked buf for block blockno, without reading it:
+// the caller is about to overwrite all of it.
+struct buf*
+bfresh(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  b = bget(dev, blockno);
+  b->valid = 1;
+  return b;
+}
+
+// Start reading block blockno into the cache, unless it is
+// there already, without waiting for the disk. The buffer
+// stays locked until the read is done, so a bread() of the
+// block meanwhile waits for it. Best effort: nothing is read
+// if there's no free buffer or the disk queue is full.
+void
+breadahead(uint dev, uint blockno)
+{
+  struct bucket *bk = &bcache.bucket[BUFHASH(dev, blockno)];
+  struct buf *b;
+
+  acquire(&bk->lock);
+  b = bfind(bk, dev, blockno);
+  release(&bk->lock);
+  if(b != 0 || (b = bmiss(bk, dev, blockno, 1)) == 0)
+    return;
+
+  acquiresleep(&b->lock);
+  if(b->valid || virtio_disk_read_async(b) < 0){
+    // someone read it first, or the disk is busy.
+    brelse(b);
+    return;
+  }
+  __sync_fetch_and_add(&bcache.readaheads, 1);
+}
+
+// Called by virtio_disk_intr() when the read started by
+// breadahead() is done: unlock b and drop its reference.
+// Like brelse(), but from an interrupt, where b's lock
+// isn't held by the current process.
+void
+bdone(struct buf *b)
+{
+  struct bucket *bk = &bcache.bucket[BUFHASH(b->dev, b->blockno)];
+
+  b->valid = 1;
+  releasesleep(&b->lock);
+  acquire(&bk->lock);
+  b->refcnt--;
+  if(b->refcnt == 0)
+    b->lastuse = __sync_fetch_and_add(&bcache.clock, 1);
+  release(&bk->lock);
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
@@ -112,42 +326,110 @@ bwrite(struct buf *b)
 }
 
 // Release a locked buffer.
-// Move to the head of the most-recently-used list.
+// Stamp it as the most recently used if no one else holds it.
 void
 brelse(struct buf *b)
 {
+  struct bucket *bk;
+
   if(!holdingsleep(&b->lock))
     panic("brelse");
 
   releasesleep(&b->lock);
 
-  acquire(&bcache.lock);
+  // b stays in its bucket while referenced.
+  bk = &bcache.bucket[BUFHASH(b->dev, b->blockno)];
+  acquire(&bk->lock);
   b->refcnt--;
   if (b->refcnt == 0) {
     // no one is waiting for it.
-    b->next->prev = b->prev;
-    b->prev->next = b->next;
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+    b->lastuse = __sync_fetch_and_add(&bcache.clock, 1);
   }
-  
-  release(&bcache.lock);
+  release(&bk->lock);
 }
 
 void
 bpin(struct buf *b) {
-  acquire(&bcache.lock);
+  struct bucket *bk = &bcache.bucket[BUFHASH(b->dev, b->blockno)];
+
+  acquire(&bk->lock);
   b->refcnt++;
-  release(&bcache.lock);
+  release(&bk->lock);
 }
 
 void
 bunpin(struct buf *b) {
-  acquire(&bcache.lock);
+  struct bucket *bk = &bcache.bucket[BUFHASH(b->dev, b->blockno)];
+
+  acquire(&bk->lock);
   b->refcnt--;
+  release(&bk->lock);
+}
+
+// Give the pages of added buffers that are all unused back to
+// kalloc, until at most nbuf buffers are left. Called by
+// kalloc() when out of memory, with nbuf 0. Returns the number
+// of pages freed.
+int
+bshrink(int nbuf)
+{
+  struct bucket *bk;
+  struct buf *b, *pb, **pp;
+  int i, j, freed = 0;
+
+  acquire(&bcache.lock);
+  for(bk = bcache.bucket; bk < bcache.bucket+NBUFHASH; bk++)
+    acquire(&bk->lock);
+  for(i = 0; i < NBUFPAGE && bcache.nbuf > nbuf; i++){
+    if((pb = (struct buf*)bcache.page[i]) == 0)
+      continue;
+    for(j = 0; j < BUFPERPAGE && pb[j].refcnt == 0; j++)
+      ;
+    if(j < BUFPERPAGE)
+      continue;
+    // unhash them all.
+    for(bk = bcache.bucket; bk < bcache.bucket+NBUFHASH; bk++){
+      for(pp = &bk->head; (b = *pp) != 0;){
+        if(b >= pb && b < pb + BUFPERPAGE)
+          *pp = b->next;
+        else
+          pp = &b->next;
+      }
+    }
+    kfree(pb);
+    bcache.page[i] = 0;
+    bcache.nbuf -= BUFPERPAGE;
+    bcache.shrinks++;
+    freed++;
+  }
+  for(bk = bcache.bucket; bk < bcache.bucket+NBUFHASH; bk++)
+    release(&bk->lock);
   release(&bcache.lock);
+  return freed;
 }
 
+// Copy the buffer cache statistics to user address addr. If
+// max is positive, make it the most buffers the cache grows
+// to, between NBUF and NBUFMAX, shrinking it if need be.
+int
+bcachestat(uint64 addr, int max)
+{
+  struct bcachestat st;
 
+  if(max > 0){
+    if(max < NBUF)
+      max = NBUF;
+    if(max > NBUFMAX)
+      max = NBUFMAX;
+    bcache.max = max;
+    bshrink(max);
+  }
+  st.hits = bcache.hits;
+  st.misses = bcache.misses;
+  st.nbuf = bcache.nbuf;
+  st.max = bcache.max;
+  st.grows = bcache.grows;
+  st.shrinks = bcache.shrinks;
+  st.readaheads = bcache.readaheads;
+  return copyout(myproc()->pagetable, addr, (char*)&st, sizeof(st));
+}
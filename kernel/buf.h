@@ -5,8 +5,8 @@ struct buf {
   uint blockno;
   struct sleeplock lock;
   uint refcnt;
-  struct buf *prev; // LRU cache list
-  struct buf *next;
+  uint64 lastuse;   // bcache.clock when refcnt last dropped to 0
+  struct buf *next; // hash bucket list
   uchar data[BSIZE];
 };
 
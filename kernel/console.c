@@ -80,7 +80,7 @@ int
 consoleread(int user_dst, uint64 dst, int n)
 {
   uint target;
-  int c;
+  int c, r;
   char cbuf;
 
   target = n;
@@ -107,10 +107,16 @@ consoleread(int user_dst, uint64 dst, int n)
       break;
     }
 
-    // copy the input byte to the user-space buffer.
+    // copy the input byte to the user-space buffer. if
+    // it's in swap, that has to be done without cons.lock.
     cbuf = c;
-    if(either_copyout(user_dst, dst, &cbuf, 1) == -1)
-      break;
+    if(either_copyout(user_dst, dst, &cbuf, 1) == -1){
+      release(&cons.lock);
+      r = either_copyout(user_dst, dst, &cbuf, 1);
+      acquire(&cons.lock);
+      if(r == -1)
+        break;
+    }
 
     dst++;
     --n;
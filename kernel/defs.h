@@ -1,6 +1,7 @@
 struct buf;
 struct context;
 struct file;
+struct page_metadata_struct;
 struct inode;
 struct pipe;
 struct proc;
@@ -8,14 +9,20 @@ struct spinlock;
 struct sleeplock;
 struct stat;
 struct superblock;
+struct swapfile;
 
 // bio.c
 void            binit(void);
 struct buf*     bread(uint, uint);
+struct buf*     bfresh(uint, uint);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
 void            bpin(struct buf*);
 void            bunpin(struct buf*);
+void            breadahead(uint, uint);
+void            bdone(struct buf*);
+int             bshrink(int);
+int             bcachestat(uint64, int);
 
 // console.c
 void            consoleinit(void);
@@ -39,6 +46,7 @@ int             kfilewrite(struct file*, uint64, int n);
 void            fsinit(int);
 int             dirlink(struct inode*, char*, uint);
 struct inode*   dirlookup(struct inode*, char*, uint*);
+void            dcache_unlink(struct inode*, char*);
 struct inode*   ialloc(uint, short);
 struct inode*   idup(struct inode*);
 void            iinit();
@@ -54,13 +62,23 @@ int             readi(struct inode*, int, uint64, uint, uint);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, int, uint64, uint, uint);
 void            itrunc(struct inode*);
+void            itruncate(struct inode*, uint);
 int		        createSwapFile(struct proc* p);
 int	          	readFromSwapFile(struct proc * p, char* buffer, uint placeOnFile, uint size);
 int		        writeToSwapFile(struct proc* p, char* buffer, uint placeOnFile, uint size);
 int		        removeSwapFile(struct proc* p);
 void		    copy_swap_file(struct proc* p_source, struct proc* p_target);
-int             write_page_to_file(struct proc * p, uint64 user_page_VA, pagetable_t pagetable);
+int             write_pages_to_file(struct proc * p, struct page_metadata_struct *pages, uint64 *pas, int n, pagetable_t pagetable);
 int             read_page_from_file(struct proc * p, int memory_index, uint64 user_page_VA, char* buff);
+void            swapinit(void);
+void            swapfile_put(struct swapfile* sf);
+void            swap_slot_get(struct swapfile* sf, int slot);
+void            swap_slot_put(struct swapfile* sf, int slot);
+int             swap_slot_alloc(struct proc* p, uint64 user_page_VA, int prev);
+int             swap_slots_top(struct swapfile* sf);
+int             swap_fragmentation(struct swapfile* sf);
+void            swap_file_trim(struct proc* p);
+void            swap_release_pages(struct proc* p);
 // ramdisk.c
 void            ramdiskinit(void);
 void            ramdiskintr(void);
@@ -68,6 +86,7 @@ void            ramdiskrw(struct buf*);
 
 // kalloc.c
 void*           kalloc(void);
+void*           kalloc_cache(void);
 void            kfree(void *);
 void            kinit(void);
 
@@ -93,10 +112,20 @@ int             cpuid(void);
 void            exit(int);
 int             fork(void);
 int             growproc(int);
+int             clone(uint64, uint64, uint64);
+void            vmlock(struct proc*);
+void            vmunlock(struct proc*);
+struct proc*    myvm(void);
+void            tlb_shootdown(struct proc*);
 void            proc_mapstacks(pagetable_t);
 pagetable_t     proc_pagetable(struct proc *);
 void            proc_freepagetable(pagetable_t, uint64);
 int             kill(int);
+void            kproc(void (*)(void), char*);
+int             pagestat(int, uint64);
+int             getrusage(int, uint64);
+int             quantum(int);
+void            runtime_charge(struct proc*, int);
 struct cpu*     mycpu(void);
 struct cpu*     getmycpu(void);
 struct proc*    myproc();
@@ -109,6 +138,8 @@ void            userinit(void);
 int             wait(uint64);
 void            wakeup(void*);
 void            yield(void);
+void            sched_tick(void);
+int             runq_least_loaded(void);
 int             either_copyout(int user_dst, uint64 dst, void *src, uint64 len);
 int             either_copyin(void *dst, int user_src, uint64 src, uint64 len);
 void            procdump(void);
@@ -121,9 +152,15 @@ void            swtch(struct context*, struct context*);
 void            acquire(struct spinlock*);
 int             holding(struct spinlock*);
 void            initlock(struct spinlock*, char*);
+void            initticketlock(struct spinlock*, char*);
 void            release(struct spinlock*);
 void            push_off(void);
 void            pop_off(void);
+struct lockstat* lockstat_get(char*, int);
+void            lockstat_acquired(struct lockstat*, int, uint64);
+void            lockstat_released(struct lockstat*, uint64);
+int             lockstat(uint64, int, int);
+int             lockbench(int, int, uint64);
 
 // sleeplock.c
 void            acquiresleep(struct sleeplock*);
@@ -158,6 +195,19 @@ void            trapinit(void);
 void            trapinithart(void);
 extern struct spinlock tickslock;
 void            usertrapret(void);
+void            tickupdate(void);
+
+// futex.c
+void            futexinit(void);
+int             futex(uint64, int, int);
+
+// timer.c
+void            timerqinit(void);
+void            timer_rearm(uint64);
+void            timer_kick(int);
+int             timer_intr(uint64);
+extern uint64   sched_quantum;
+int             sleep_until(uint64);
 
 // uart.c
 void            uartinit(void);
@@ -183,22 +233,33 @@ uint64          walkaddr(pagetable_t, uint64);
 int             copyout(pagetable_t, uint64, char *, uint64);
 int             copyin(pagetable_t, char *, uint64, uint64);
 int             copyinstr(pagetable_t, char *, uint64, uint64);
+int             uvmpagein(uint64, uint64);
 int             get_page_from_file(uint64 r_stval);
 int             page_in_file(uint64 user_page_va, pagetable_t pagetable);
 void            update_page_out_pte(pagetable_t pagetable, uint64 user_page_va);
 void            update_page_in_pte(pagetable_t pagetable, uint64 user_page_va, uint64 page_pa, int index);
 void            add_to_memory_page_metadata(pagetable_t pagetable, uint64 user_page_va);
 int             get_swap_out_page_index();
+int             get_swap_out_pages(int *victims, int k);
+int             swap_out_pages(pagetable_t pagetable, int k);
+void            evict_pages(pagetable_t pagetable, struct page_metadata_struct *pages, int n);
 void            update_access_counter(struct proc*);
+void            page_aging(struct proc*);
 uint            num_of_ones(uint access_count);
 int             is_none_policy();
+int             paging_policy();
 void            remove_from_memory_meta_data(uint64 user_page_va, pagetable_t pagetable);
 void            remove_from_file_meta_data(uint64 user_page_va, pagetable_t pagetable);
-int             SCFIFO_algorithm();
-int             LAPA_algorithm();
-int             NFUA_algorithm();
+int             SCFIFO_algorithm(uint skip);
+int             LAPA_algorithm(uint skip);
+int             NFUA_algorithm(uint skip);
 void            print_memory_metadata_state(struct proc *p);
 pte_t*         walk(pagetable_t pagetable, uint64 va, int alloc);
+uint64          hart_asid(struct proc*);
+void            tlb_flush(struct proc*, uint64, uint64);
+void            tlb_flush_asid(struct proc*);
+void            tlb_sync(struct proc*);
+int             tlb_spurious_fault(struct proc*, uint64, uint64);
 
 // plic.c
 void            plicinit(void);
@@ -209,6 +270,8 @@ void            plic_complete(int);
 // virtio_disk.c
 void            virtio_disk_init(void);
 void            virtio_disk_rw(struct buf *, int);
+void            virtio_disk_rwv(struct buf **, int, int);
+int             virtio_disk_read_async(struct buf *);
 void            virtio_disk_intr(void);
 
 // number of elements in fixed-size array
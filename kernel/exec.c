@@ -20,6 +20,10 @@ exec(char *path, char **argv) {
     pagetable_t pagetable = 0, oldpagetable;
     struct proc *p = myproc();
 
+    // the other threads would lose their address space.
+    if (p->leader != p || p->nthreads > 1)
+        return -1;
+
     begin_op();
 
     if ((ip = namei(path)) == 0) {
@@ -40,7 +44,7 @@ exec(char *path, char **argv) {
 
     if (!is_none_policy() && p->pid > 2) {
         clear_memory_metadata();
-        if (myproc()->swapFile)
+        if (myproc()->swap)
             // delete parent copied swapFile
             removeSwapFile(myproc());
 
@@ -124,6 +128,8 @@ exec(char *path, char **argv) {
     p->trapframe->epc = elf.entry;  // initial program counter = main
     p->trapframe->sp = sp; // initial stack pointer
     proc_freepagetable(oldpagetable, oldsz);
+    // the old image's translations still carry our ASID.
+    tlb_flush_asid(p);
 
     return argc; // this ends up in a0, the first argument to main(argc, argv)
 
@@ -134,7 +140,7 @@ exec(char *path, char **argv) {
         iunlockput(ip);
         end_op();
     }
-    if (myproc()->swapFile)
+    if (myproc()->swap)
         removeSwapFile(myproc());
     return -1;
 }
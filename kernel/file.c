@@ -167,8 +167,11 @@ filewrite(struct file *f, uint64 addr, int n)
       end_op();
 
       if(r != n1){
-        // error from writei
-        break;
+        // error from writei, or it stopped at a page in
+        // swap, which can be paged in now that we're
+        // outside the transaction.
+        if(r < 0 || uvmpagein(addr + i + r, 1) < 0)
+          break;
       }
       i += r;
     }
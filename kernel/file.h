@@ -18,6 +18,9 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  struct inode *hnext;   // itable hash chain
+  struct inode *lru_prev; // unreferenced inodes, least recently used first
+  struct inode *lru_next;
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
 
@@ -26,7 +29,13 @@ struct inode {
   short minor;
   short nlink;
   uint size;
-  uint addrs[NDIRECT+1];
+  uint addrs[NDIRECT+2];
+
+  uint map_bn;        // first block in map, 0 if none
+  uint map[NBMAP];    // cached addresses of blocks map_bn.., 0 unknown
+  uint ra_next;       // block a sequential readi() reads next
+  uint ra_end;        // blocks before this are read ahead
+  uint ra_win;        // blocks to read ahead, 0 if not sequential
 };
 
 // map major device number to device functions.
@@ -26,6 +26,10 @@
 // only one device
 struct superblock sb;
 
+static void bsummary(int);
+static void dcacheinit(void);
+static void dcache_purge(uint, uint);
+
 // Read the super block.
 static void
 readsb(int dev, struct superblock *sb) {
@@ -43,42 +47,143 @@ fsinit(int dev) {
     if (sb.magic != FSMAGIC)
         panic("invalid file system");
     initlog(dev, &sb);
+    bsummary(dev);
 }
 
-// Zero a block.
+// Zero a block. Its old contents don't matter, so it
+// isn't read from disk.
 static void
 bzero(int dev, int bno) {
     struct buf *bp;
 
-    bp = bread(dev, bno);
+    bp = bfresh(dev, bno);
     memset(bp->data, 0, BSIZE);
     log_write(bp);
     brelse(bp);
 }
 
 // Blocks.
+//
+// The blocks are split into groups of BGROUP blocks, and
+// bfs keeps the number of free blocks in each, so balloc()
+// skips full groups without reading their bitmap, and a
+// next-fit hint, so it doesn't start from block 0 each
+// time. The bitmap itself is scanned 64 bits at a time.
+// A block is allocated as close after a goal as possible,
+// normally the block before it in the file, so that files
+// growing sequentially get runs of consecutive blocks.
+
+#define BGROUP 1024  // blocks per group; divides BPB
+#define NBGROUP ((FSSIZE + BGROUP - 1) / BGROUP)
 
-// Allocate a zeroed disk block.
-static uint
-balloc(uint dev) {
-    int b, bi, m;
-    struct buf *bp;
+struct {
+    struct spinlock lock;
+    uint ngroup;           // groups in use
+    uint hint;             // where to look when there's no goal
+    uint nfree[NBGROUP];   // free blocks per group
+} bfs;
+
+// Return the index of the lowest 0 bit of w, which has one.
+static int
+lowzero(uint64 w) {
+    int i = 0;
+
+    w = ~w;
+    if ((w & 0xffffffff) == 0) { i += 32; w >>= 32; }
+    if ((w & 0xffff) == 0) { i += 16; w >>= 16; }
+    if ((w & 0xff) == 0) { i += 8; w >>= 8; }
+    if ((w & 0xf) == 0) { i += 4; w >>= 4; }
+    if ((w & 0x3) == 0) { i += 2; w >>= 2; }
+    if ((w & 0x1) == 0) i += 1;
+    return i;
+}
 
-    bp = 0;
+// Count the free blocks of each group, from the bitmap.
+static void
+bsummary(int dev) {
+    struct buf *bp;
+    uint64 *w, x;
+    uint b, i;
+
+    if ((sb.size + BGROUP - 1) / BGROUP > NBGROUP)
+        panic("bsummary: file system too big");
+    initlock(&bfs.lock, "bfs");
+    bfs.ngroup = (sb.size + BGROUP - 1) / BGROUP;
+    bfs.hint = 0;
     for (b = 0; b < sb.size; b += BPB) {
         bp = bread(dev, BBLOCK(b, sb));
-        for (bi = 0; bi < BPB && b + bi < sb.size; bi++) {
-            m = 1 << (bi % 8);
-            if ((bp->data[bi / 8] & m) == 0) {  // Is block free?
-                bp->data[bi / 8] |= m;  // Mark block in use.
-                log_write(bp);
-                brelse(bp);
-                bzero(dev, b + bi);
-                return b + bi;
-            }
+        w = (uint64 *) bp->data;
+        for (i = 0; i < BPB / 64 && b + i * 64 < sb.size; i++) {
+            x = w[i];
+            if (sb.size - (b + i * 64) < 64)  // blocks past the end aren't free
+                x |= ~0UL << (sb.size - (b + i * 64));
+            for (x = ~x; x; x &= x - 1)
+                bfs.nfree[(b + i * 64) / BGROUP]++;
         }
         brelse(bp);
     }
+}
+
+// Allocate the first free block from block from on, but
+// before block to, both in one group. Returns 0 if none.
+static uint
+bscan(uint dev, uint from, uint to) {
+    struct buf *bp;
+    uint64 *w, x;
+    uint base = from - from % BPB;
+    uint i, b;
+
+    bp = bread(dev, BBLOCK(from, sb));
+    w = (uint64 *) bp->data;
+    for (i = (from % BPB) / 64; base + i * 64 < to; i++) {
+        x = w[i];
+        if (i == (from % BPB) / 64)   // skip the blocks before from
+            x |= (1UL << (from % 64)) - 1;
+        if (x == ~0UL)
+            continue;
+        b = base + i * 64 + lowzero(x);
+        if (b >= to)
+            break;
+        w[i] |= 1UL << (b % 64);  // Mark block in use.
+        log_write(bp);
+        acquire(&bfs.lock);
+        bfs.nfree[b / BGROUP]--;
+        bfs.hint = b + 1 < sb.size ? b + 1 : 0;
+        release(&bfs.lock);
+        brelse(bp);
+        return b;
+    }
+    brelse(bp);
+    return 0;
+}
+
+// Allocate a zeroed disk block, as soon after goal as
+// possible, or after the hint if goal is 0.
+static uint
+balloc(uint dev, uint goal) {
+    uint g, first, i, nfree, b, end;
+
+    acquire(&bfs.lock);
+    if (goal == 0 || goal >= sb.size)
+        goal = bfs.hint;
+    release(&bfs.lock);
+
+    // goal's group from goal on, the other groups, then the
+    // start of goal's group.
+    first = goal / BGROUP;
+    for (i = 0; i <= bfs.ngroup; i++) {
+        g = (first + i) % bfs.ngroup;
+        acquire(&bfs.lock);
+        nfree = bfs.nfree[g];
+        release(&bfs.lock);
+        if (nfree == 0)
+            continue;
+        end = (g + 1) * BGROUP < sb.size ? (g + 1) * BGROUP : sb.size;
+        if ((b = bscan(dev, i == 0 ? goal : g * BGROUP, end)) != 0) {
+            bzero(dev, b);
+            return b;
+        }
+    }
     panic("balloc: out of blocks");
 }
 
@@ -95,6 +200,9 @@ bfree(int dev, uint b) {
         panic("freeing free block");
     bp->data[bi / 8] &= ~m;
     log_write(bp);
+    acquire(&bfs.lock);
+    bfs.nfree[b / BGROUP]++;
+    release(&bfs.lock);
     brelse(bp);
 }
 
@@ -130,11 +238,18 @@ bfree(int dev, uint b) {
 //   creates a table entry and increments its ref; iput()
 //   decrements ref.
 //
+// * Caching: a free entry keeps its inode, hashed and
+//   valid, on a list of free entries in least recently
+//   used order, so iget() of it needn't read it again.
+//   iget() recycles the least recently used free entry
+//   for another inode, and adds a page of entries to the
+//   table if none is free.
+//
 // * Valid: the information (type, size, &c) in an inode
 //   table entry is only correct when ip->valid is 1.
 //   ilock() reads the inode from
 //   the disk and sets ip->valid, while iput() clears
-//   ip->valid if ip->ref has fallen to zero.
+//   ip->valid if it frees the inode.
 //
 // * Locked: file system code may only examine and modify
 //   the information in an inode and its content if it
@@ -161,25 +276,78 @@ bfree(int dev, uint b) {
 // The itable.lock spin-lock protects the allocation of itable
 // entries. Since ip->ref indicates whether an entry is free,
 // and ip->dev and ip->inum indicate which i-node an entry
-// holds, one must hold itable.lock while using any of those fields.
+// holds, one must hold itable.lock while using any of those fields,
+// or the hash chain and free list links.
 //
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
 // dev, and inum.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
 
+#define IPERPAGE (PGSIZE / sizeof(struct inode))
+#define IHASH(dev, inum) (((dev) * 31 + (inum)) % NIHASH)
+
 struct {
     struct spinlock lock;
-    struct inode inode[NINODE];
+    struct inode inode[NINODE];   // the first entries
+    struct inode *hash[NIHASH];   // entries holding an inode, by inum
+    struct inode *lru_head;       // free entries, least recently used first
+    struct inode *lru_tail;
+    int ninode;                   // entries, those added included
 } itable;
 
+// Put free entry ip at the tail of the free list, or at the
+// head if its inode isn't worth keeping.
+// Caller must hold itable.lock.
+static void
+lru_add(struct inode *ip, int head) {
+    if (itable.lru_head == 0) {
+        ip->lru_prev = ip->lru_next = 0;
+        itable.lru_head = itable.lru_tail = ip;
+    } else if (head) {
+        ip->lru_prev = 0;
+        ip->lru_next = itable.lru_head;
+        itable.lru_head->lru_prev = ip;
+        itable.lru_head = ip;
+    } else {
+        ip->lru_next = 0;
+        ip->lru_prev = itable.lru_tail;
+        itable.lru_tail->lru_next = ip;
+        itable.lru_tail = ip;
+    }
+}
+
+// Take ip off the free list. Caller must hold itable.lock.
+static void
+lru_remove(struct inode *ip) {
+    if (ip->lru_prev)
+        ip->lru_prev->lru_next = ip->lru_next;
+    else
+        itable.lru_head = ip->lru_next;
+    if (ip->lru_next)
+        ip->lru_next->lru_prev = ip->lru_prev;
+    else
+        itable.lru_tail = ip->lru_prev;
+    ip->lru_prev = ip->lru_next = 0;
+}
+
+// Add n entries, at ip, to the free list.
+// Caller must hold itable.lock.
+static void
+igrow(struct inode *ip, int n) {
+    for (; n > 0; n--, ip++) {
+        initsleeplock(&ip->lock, "inode");
+        lru_add(ip, 1);
+        itable.ninode++;
+    }
+}
+
 void
 iinit() {
-    int i = 0;
-
     initlock(&itable.lock, "itable");
-    for (i = 0; i < NINODE; i++) {
-        initsleeplock(&itable.inode[i].lock, "inode");
-    }
+    acquire(&itable.lock);
+    igrow(itable.inode, NINODE);
+    release(&itable.lock);
+    dcacheinit();
 }
 
 static struct inode *iget(uint dev, uint inum);
@@ -234,29 +402,45 @@ iupdate(struct inode *ip) {
 // the inode and does not read it from disk.
 static struct inode *
 iget(uint dev, uint inum) {
-    struct inode *ip, *empty;
+    struct inode *ip, **pp;
+    char *page;
     acquire(&itable.lock);
 
     // Is the inode already in the table?
-    empty = 0;
-    for (ip = &itable.inode[0]; ip < &itable.inode[NINODE]; ip++) {
-        if (ip->ref > 0 && ip->dev == dev && ip->inum == inum) {
+    for (ip = itable.hash[IHASH(dev, inum)]; ip != 0; ip = ip->hnext) {
+        if (ip->dev == dev && ip->inum == inum) {
+            if (ip->ref == 0)
+                lru_remove(ip);
             ip->ref++;
             release(&itable.lock);
             return ip;
         }
-        if (empty == 0 && ip->ref == 0)    // Remember empty slot.
-            empty = ip;
     }
-    // Recycle an inode entry.
-    if (empty == 0)
-        panic("iget: no inodes");
 
-    ip = empty;
+    // Recycle the least recently used free entry, adding
+    // entries if there are none.
+    if (itable.lru_head == 0) {
+        if ((page = kalloc()) == 0)
+            panic("iget: no inodes");
+        memset(page, 0, PGSIZE);
+        igrow((struct inode *) page, IPERPAGE);
+    }
+    ip = itable.lru_head;
+    lru_remove(ip);
+    if (ip->inum) {
+        for (pp = &itable.hash[IHASH(ip->dev, ip->inum)]; *pp != ip; pp = &(*pp)->hnext)
+            ;
+        *pp = ip->hnext;
+    }
+
     ip->dev = dev;
     ip->inum = inum;
+    ip->hnext = itable.hash[IHASH(dev, inum)];
+    itable.hash[IHASH(dev, inum)] = ip;
     ip->ref = 1;
     ip->valid = 0;
+    ip->ra_next = ip->ra_end = ip->ra_win = 0;
+    ip->map_bn = 0;
     release(&itable.lock);
 
     return ip;
@@ -329,6 +513,8 @@ iput(struct inode *ip) {
 
         release(&itable.lock);
 
+        if (ip->type == T_DIR)
+            dcache_purge(ip->dev, ip->inum);
         itrunc(ip);
         ip->type = 0;
         iupdate(ip);
@@ -340,6 +526,10 @@ iput(struct inode *ip) {
     }
 
     ip->ref--;
+    if (ip->ref == 0) {
+        // keep it for the next iget(), unless it was freed.
+        lru_add(ip, !ip->valid);
+    }
     release(&itable.lock);
 }
 
@@ -355,70 +545,185 @@ iunlockput(struct inode *ip) {
 // The content (data) associated with each inode is stored
 // in blocks on the disk. The first NDIRECT block numbers
 // are listed in ip->addrs[].  The next NINDIRECT blocks are
-// listed in block ip->addrs[NDIRECT].
+// listed in block ip->addrs[NDIRECT]. The NDINDIRECT blocks
+// after those are listed in the NINDIRECT blocks listed in
+// block ip->addrs[NDIRECT+1].
+//
+// Each in-memory inode also caches a run of NBMAP block
+// addresses, copied from the last indirect block of data
+// block addresses that bmap() read, so that reading or
+// writing a file sequentially reads its indirect blocks once
+// per NBMAP blocks rather than once per block.
+
+// Return entry i of indirect block addr. If it is 0 and alloc
+// is set, allocate a block for it, after the block of entry
+// i-1, or else after addr itself.
+static uint
+bmap_ind(struct inode *ip, uint addr, uint i, int alloc) {
+    struct buf *bp;
+    uint *a, x;
 
-// Return the disk block address of the nth block in inode ip.
-// If there is no such block, bmap allocates one.
+    bp = bread(ip->dev, addr);
+    a = (uint *) bp->data;
+    if ((x = a[i]) == 0 && alloc) {
+        a[i] = x = balloc(ip->dev, (i > 0 && a[i-1] ? a[i-1] : addr) + 1);
+        log_write(bp);
+    }
+    brelse(bp);
+    return x;
+}
+
+// Return entry i of indirect block addr, which lists the data
+// blocks from block bn - i of ip on, allocating it as
+// bmap_ind() does, and copy the run of NBMAP entries around
+// it to ip's block-map cache.
 static uint
-bmap(struct inode *ip, uint bn) {
-    uint addr, *a;
+bmap_leaf(struct inode *ip, uint addr, uint i, uint bn, int alloc) {
     struct buf *bp;
+    uint *a, x, first = i - i % NBMAP;
+
+    bp = bread(ip->dev, addr);
+    a = (uint *) bp->data;
+    if ((x = a[i]) == 0 && alloc) {
+        a[i] = x = balloc(ip->dev, (i > 0 && a[i-1] ? a[i-1] : addr) + 1);
+        log_write(bp);
+    }
+    memmove(ip->map, a + first, sizeof(ip->map));
+    ip->map_bn = bn - (i - first);
+    brelse(bp);
+    return x;
+}
+
+// Return the disk block address of the nth block in inode ip.
+// If there is no such block, allocate one if alloc is set,
+// else return 0.
+static uint
+bmap_alloc(struct inode *ip, uint bn, int alloc) {
+    uint addr, lbn;
 
     if (bn < NDIRECT) {
-        if ((addr = ip->addrs[bn]) == 0)
-            ip->addrs[bn] = addr = balloc(ip->dev);
+        if ((addr = ip->addrs[bn]) == 0 && alloc)
+            ip->addrs[bn] = addr = balloc(ip->dev, bn > 0 && ip->addrs[bn-1] ? ip->addrs[bn-1] + 1 : 0);
         return addr;
     }
-    bn -= NDIRECT;
 
-    if (bn < NINDIRECT) {
+    // a cached address needs no indirect block.
+    if (ip->map_bn && bn - ip->map_bn < NBMAP && (addr = ip->map[bn - ip->map_bn]) != 0)
+        return addr;
+
+    lbn = bn - NDIRECT;
+    if (lbn < NINDIRECT) {
         // Load indirect block, allocating if necessary.
-        if ((addr = ip->addrs[NDIRECT]) == 0)
-            ip->addrs[NDIRECT] = addr = balloc(ip->dev);
-        bp = bread(ip->dev, addr);
-        a = (uint *) bp->data;
-        if ((addr = a[bn]) == 0) {
-            a[bn] = addr = balloc(ip->dev);
-            log_write(bp);
+        if ((addr = ip->addrs[NDIRECT]) == 0) {
+            if (!alloc)
+                return 0;
+            ip->addrs[NDIRECT] = addr = balloc(ip->dev, ip->addrs[NDIRECT-1] ? ip->addrs[NDIRECT-1] + 1 : 0);
         }
-        brelse(bp);
-        return addr;
+        return bmap_leaf(ip, addr, lbn, bn, alloc);
+    }
+    lbn -= NINDIRECT;
+
+    if (lbn < NDINDIRECT) {
+        // Load the double-indirect block, then the indirect
+        // block it lists, allocating if necessary.
+        if ((addr = ip->addrs[NDIRECT+1]) == 0) {
+            if (!alloc)
+                return 0;
+            ip->addrs[NDIRECT+1] = addr = balloc(ip->dev, 0);
+        }
+        if ((addr = bmap_ind(ip, addr, lbn / NINDIRECT, alloc)) == 0)
+            return 0;
+        return bmap_leaf(ip, addr, lbn % NINDIRECT, bn, alloc);
     }
 
     panic("bmap: out of range");
 }
 
-// Truncate inode (discard contents).
-// Caller must hold ip->lock.
-void
-itrunc(struct inode *ip) {
-    int i, j;
+// Return the disk block address of the nth block in inode ip.
+// If there is no such block, bmap allocates one.
+static uint
+bmap(struct inode *ip, uint bn) {
+    return bmap_alloc(ip, bn, 1);
+}
+
+// Free the blocks of ip from block first on that indirect
+// block addr lists, the blocks it lists starting at block
+// base. level is 1 if it lists data blocks, 2 if it lists
+// indirect blocks. Returns 1 if it still lists any block.
+static int
+bfree_ind(struct inode *ip, uint addr, int level, uint base, uint first) {
     struct buf *bp;
-    uint *a;
+    uint *a, span = level == 1 ? 1 : NINDIRECT;
+    int i, used = 0, changed = 0;
 
-    for (i = 0; i < NDIRECT; i++) {
-        if (ip->addrs[i]) {
-            bfree(ip->dev, ip->addrs[i]);
-            ip->addrs[i] = 0;
+    bp = bread(ip->dev, addr);
+    a = (uint *) bp->data;
+    for (i = 0; i < NINDIRECT; i++) {
+        if (a[i] == 0)
+            continue;
+        if (base + (i + 1) * span <= first ||
+            (level > 1 && bfree_ind(ip, a[i], level - 1, base + i * span, first))) {
+            used = 1;
+            continue;
         }
+        bfree(ip->dev, a[i]);
+        a[i] = 0;
+        changed = 1;
     }
+    // an indirect block no longer in use needn't be logged.
+    if (used && changed)
+        log_write(bp);
+    brelse(bp);
+    return used;
+}
 
-    if (ip->addrs[NDIRECT]) {
-        bp = bread(ip->dev, ip->addrs[NDIRECT]);
-        a = (uint *) bp->data;
-        for (j = 0; j < NINDIRECT; j++) {
-            if (a[j])
-                bfree(ip->dev, a[j]);
+// Free the blocks of ip from block first on.
+static void
+bfree_from(struct inode *ip, uint first) {
+    uint bn;
+
+    for (bn = first; bn < NDIRECT; bn++) {
+        if (ip->addrs[bn]) {
+            bfree(ip->dev, ip->addrs[bn]);
+            ip->addrs[bn] = 0;
         }
-        brelse(bp);
+    }
+
+    if (ip->addrs[NDIRECT] &&
+        !bfree_ind(ip, ip->addrs[NDIRECT], 1, NDIRECT, first)) {
         bfree(ip->dev, ip->addrs[NDIRECT]);
         ip->addrs[NDIRECT] = 0;
     }
 
+    if (ip->addrs[NDIRECT+1] &&
+        !bfree_ind(ip, ip->addrs[NDIRECT+1], 2, NDIRECT + NINDIRECT, first)) {
+        bfree(ip->dev, ip->addrs[NDIRECT+1]);
+        ip->addrs[NDIRECT+1] = 0;
+    }
+
+    ip->map_bn = 0;
+}
+
+// Truncate inode (discard contents).
+// Caller must hold ip->lock.
+void
+itrunc(struct inode *ip) {
+    bfree_from(ip, 0);
     ip->size = 0;
     iupdate(ip);
 }
 
+// Discard the blocks of ip beyond size bytes and shrink it.
+// Caller must hold ip->lock.
+void
+itruncate(struct inode *ip, uint size) {
+    if (size >= ip->size)
+        return;
+    bfree_from(ip, (size + BSIZE - 1) / BSIZE);
+    ip->size = size;
+    iupdate(ip);
+}
+
 // Copy stat information from inode.
 // Caller must hold ip->lock.
 void
@@ -430,29 +735,85 @@ stati(struct inode *ip, struct stat *st) {
     st->size = ip->size;
 }
 
+// Sequential read-ahead. A readi() that starts in the block
+// where the last one ended continues a sequential read: it
+// starts reading the blocks it covers, and a window past
+// them, without waiting, so that the disk works while the
+// reader copies. The window doubles on each sequential
+// readi(), up to NREADAHEAD blocks, and closes on a seek.
+// Caller must hold ip->lock.
+static void
+readahead(struct inode *ip, uint off, uint n) {
+    uint bn = off / BSIZE;
+    uint last, end, addr;
+
+    if (n == 0)
+        return;
+    if (off == 0 || bn != ip->ra_next) {
+        // a new start.
+        ip->ra_win = 0;
+        ip->ra_end = 0;
+    } else if (ip->ra_win == 0) {
+        ip->ra_win = 2;
+    } else if (ip->ra_win < NREADAHEAD) {
+        ip->ra_win *= 2;
+        if (ip->ra_win > NREADAHEAD)
+            ip->ra_win = NREADAHEAD;
+    }
+    ip->ra_next = (off + n) / BSIZE;
+
+    if (ip->ra_win == 0)
+        return;
+    // the blocks of this read after the first, and the window.
+    last = (off + n - 1) / BSIZE;
+    end = last + 1 + ip->ra_win;
+    if (end > (ip->size + BSIZE - 1) / BSIZE)
+        end = (ip->size + BSIZE - 1) / BSIZE;
+    if (ip->ra_end < bn + 1)
+        ip->ra_end = bn + 1;
+    for (; ip->ra_end < end; ip->ra_end++) {
+        if ((addr = bmap_alloc(ip, ip->ra_end, 0)) != 0)
+            breadahead(ip->dev, addr);
+    }
+}
+
 // Read data from inode.
 // Caller must hold ip->lock.
 // If user_dst==1, then dst is a user virtual address;
 // otherwise, dst is a kernel address.
 int
 readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n) {
+    struct proc *p = myproc();
     uint tot, m;
     struct buf *bp;
+    int r;
 
     if (off > ip->size || off + n < off)
         return 0;
     if (off + n > ip->size)
         n = ip->size - off;
 
+    readahead(ip, off, n);
     for (tot = 0; tot < n; tot += m, off += m, dst += m) {
         bp = bread(ip->dev, bmap(ip, off / BSIZE));
         m = min(n - tot, BSIZE - off % BSIZE);
-        if (either_copyout(user_dst, dst, bp->data + (off % BSIZE), m) == -1) {
-            brelse(bp);
+        // paging in while holding bp could wait for a commit
+        // that waits for bp.
+        if (user_dst)
+            p->nofault++;
+        r = either_copyout(user_dst, dst, bp->data + (off % BSIZE), m);
+        if (user_dst)
+            p->nofault--;
+        brelse(bp);
+        if (r == -1) {
+            // dst may be in swap: bring it in, then read the block again.
+            if (user_dst && uvmpagein(dst, m) == 0) {
+                m = 0;
+                continue;
+            }
             tot = -1;
             break;
         }
-        brelse(bp);
     }
     return tot;
 }
@@ -463,11 +824,14 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n) {
 // otherwise, src is a kernel address.
 // Returns the number of bytes successfully written.
 // If the return value is less than the requested n,
-// there was an error of some kind.
+// there was an error of some kind, or src is in swap:
+// we're inside a transaction, so the caller pages it in.
 int
 writei(struct inode *ip, int user_src, uint64 src, uint off, uint n) {
+    struct proc *p = myproc();
     uint tot, m;
     struct buf *bp;
+    int r;
 
     if (off > ip->size || off + n < off)
         return -1;
@@ -477,7 +841,12 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n) {
     for (tot = 0; tot < n; tot += m, off += m, src += m) {
         bp = bread(ip->dev, bmap(ip, off / BSIZE));
         m = min(n - tot, BSIZE - off % BSIZE);
-        if (either_copyin(bp->data + (off % BSIZE), user_src, src, m) == -1) {
+        if (user_src)
+            p->nofault++;
+        r = either_copyin(bp->data + (off % BSIZE), user_src, src, m);
+        if (user_src)
+            p->nofault--;
+        if (r == -1) {
             brelse(bp);
             break;
         }
@@ -503,6 +872,129 @@ namecmp(const char *s, const char *t) {
     return strncmp(s, t, DIRSIZ);
 }
 
+// Directory name cache.
+//
+// The dcache remembers what dirlookup() found: the inode
+// number and dirent offset of a name in a directory, or that
+// the name isn't there (inum 0), so looking a name up again
+// reads no directory blocks. Entries are hashed by directory
+// and name into sets of DCWAYS, and the least recently used
+// of a set is replaced. A directory only changes under its
+// lock, through dirlink() and unlink, which update the cache
+// to match; a directory's entries are dropped when its inode
+// is freed, since the inode number may be used again.
+
+#define DCWAYS 4
+#define NDCSET (NDCACHE / DCWAYS)
+
+struct dentry {
+    uint dev;
+    uint dir;           // inum of the directory, 0 if unused
+    char name[DIRSIZ];
+    uint inum;          // 0 if name isn't in dir
+    uint off;           // byte offset of its dirent in dir
+    uint64 lastuse;
+};
+
+struct {
+    struct spinlock lock;
+    uint64 clock;
+    struct dentry set[NDCSET][DCWAYS];
+} dcache;
+
+static void
+dcacheinit(void) {
+    initlock(&dcache.lock, "dcache");
+}
+
+static struct dentry *
+dcache_set(uint dev, uint dir, const char *name) {
+    uint h = dev * 31 + dir;
+    int i;
+
+    for (i = 0; i < DIRSIZ && name[i]; i++)
+        h = h * 31 + (uchar) name[i];
+    return dcache.set[h % NDCSET];
+}
+
+// Return name's entry in dp's set, or 0.
+// Caller must hold dcache.lock.
+static struct dentry *
+dcache_find(struct inode *dp, const char *name) {
+    struct dentry *d = dcache_set(dp->dev, dp->inum, name);
+    int i;
+
+    for (i = 0; i < DCWAYS; i++) {
+        if (d[i].dir == dp->inum && d[i].dev == dp->dev && namecmp(d[i].name, name) == 0) {
+            d[i].lastuse = ++dcache.clock;
+            return &d[i];
+        }
+    }
+    return 0;
+}
+
+// Look name up in directory dp in the cache. Returns 1 and
+// sets *inum (0 if name isn't there) and *off if it's cached.
+static int
+dcache_get(struct inode *dp, const char *name, uint *inum, uint *off) {
+    struct dentry *d;
+
+    acquire(&dcache.lock);
+    if ((d = dcache_find(dp, name)) != 0) {
+        *inum = d->inum;
+        *off = d->off;
+    }
+    release(&dcache.lock);
+    return d != 0;
+}
+
+// Record that name is at byte offset off of directory dp,
+// with inode number inum, or isn't there if inum is 0.
+// Caller must hold dp->lock.
+static void
+dcache_put(struct inode *dp, const char *name, uint inum, uint off) {
+    struct dentry *d, *set;
+    int i;
+
+    acquire(&dcache.lock);
+    if ((d = dcache_find(dp, name)) == 0) {
+        set = dcache_set(dp->dev, dp->inum, name);
+        // an unused entry, or else the least recently used.
+        d = &set[0];
+        for (i = 1; i < DCWAYS && d->dir != 0; i++) {
+            if (set[i].dir == 0 || set[i].lastuse < d->lastuse)
+                d = &set[i];
+        }
+        d->dev = dp->dev;
+        d->dir = dp->inum;
+        strncpy(d->name, name, DIRSIZ);
+        d->lastuse = ++dcache.clock;
+    }
+    d->inum = inum;
+    d->off = off;
+    release(&dcache.lock);
+}
+
+// name was removed from directory dp.
+// Caller must hold dp->lock.
+void
+dcache_unlink(struct inode *dp, char *name) {
+    dcache_put(dp, name, 0, 0);
+}
+
+// Forget the entries of directory dir, being freed.
+static void
+dcache_purge(uint dev, uint dir) {
+    struct dentry *d;
+
+    acquire(&dcache.lock);
+    for (d = &dcache.set[0][0]; d < &dcache.set[NDCSET][0]; d++) {
+        if (d->dir == dir && d->dev == dev)
+            d->dir = 0;
+    }
+    release(&dcache.lock);
+}
+
 // Look for a directory entry in a directory.
 // If found, set *poff to byte offset of entry.
 struct inode *
@@ -513,6 +1005,14 @@ dirlookup(struct inode *dp, char *name, uint *poff) {
     if (dp->type != T_DIR)
         panic("dirlookup not DIR");
 
+    if (dcache_get(dp, name, &inum, &off)) {
+        if (inum == 0)
+            return 0;
+        if (poff)
+            *poff = off;
+        return iget(dp->dev, inum);
+    }
+
     for (off = 0; off < dp->size; off += sizeof(de)) {
         if (readi(dp, 0, (uint64) &de, off, sizeof(de)) != sizeof(de))
             panic("dirlookup read");
@@ -523,10 +1023,12 @@ dirlookup(struct inode *dp, char *name, uint *poff) {
             if (poff)
                 *poff = off;
             inum = de.inum;
+            dcache_put(dp, name, inum, off);
             return iget(dp->dev, inum);
         }
     }
 
+    dcache_put(dp, name, 0, 0);
     return 0;
 }
 
@@ -555,6 +1057,7 @@ dirlink(struct inode *dp, char *name, uint inum) {
     de.inum = inum;
     if (writei(dp, 0, (uint64) &de, off, sizeof(de)) != sizeof(de))
         panic("dirlink");
+    dcache_put(dp, name, inum, off);
 
     return 0;
 }
@@ -685,10 +1188,13 @@ removeSwapFile(struct proc *p) {
     char name[DIRSIZ];
     uint off;
 
-    if (0 == p->swapFile) {
+    if (0 == p->swap) {
         return -1;
     }
-    fileclose(p->swapFile);
+    // children may still hold slots of the file; it is closed
+    // when the last of them lets go.
+    swapfile_put(p->swap);
+    p->swap = 0;
 
     begin_op();
     if ((dp = nameiparent(path, name)) == 0) {
@@ -716,6 +1222,7 @@ removeSwapFile(struct proc *p) {
     memset(&de, 0, sizeof(de));
     if (writei(dp, 0, (uint64) &de, off, sizeof(de)) != sizeof(de))
         panic("unlink: writei");
+    dcache_unlink(dp, name);
     if (ip->type == T_DIR) {
         dp->nlink--;
         iupdate(dp);
@@ -737,11 +1244,118 @@ removeSwapFile(struct proc *p) {
 
 }
 
+// Swap files.
+//
+// A paging process owns a swap file, /.swapN, described by a
+// struct swapfile in swaptable. A swapped-out page lives in a slot
+// of some swap file, at offset slot*PGSIZE; its file_pages[] entry
+// records which file (swap) and slot. Only the owner allocates
+// slots in its file, but slots are reference counted:
+//
+// * fork() gives the child references to the parent's slots
+//   instead of copying them (copy_swap_file()).
+// * a process that swaps a shared page in keeps its reference as
+//   long as the page stays clean (PTE_D off), so evicting it again
+//   just points back at the old slot. Only a dirtied page is
+//   written to a new slot of the process's own file.
+//
+// A file has SWAP_FILE_SLOTS slots, twice what its owner can use.
+// fork() only shares the parent's slots while at most
+// SWAP_FILE_SLOTS - MAX_SWAP_PAGES of them are in use, so slots
+// held for children can never crowd the owner out.
+//
+// swaptable.lock protects ref, bitmap and slotref of every entry.
+// backed is only used by the owner.
+
+struct {
+    struct spinlock lock;
+    struct swapfile swapfile[NSWAPFILE];
+} swaptable;
+
+#if SWAP_FILE_SLOTS > 32
+#error "swapfile bitmap holds at most 32 slots"
+#endif
+
+#define SWAP_SLOTS_MASK ((uint) ((1UL << SWAP_FILE_SLOTS) - 1))
+
+void
+swapinit(void) {
+    initlock(&swaptable.lock, "swaptable");
+}
+
+// Drop one reference to sf; swaptable.lock must be held.
+// Returns the file to close if that was the last one.
+static struct file *
+swapfile_unref(struct swapfile *sf) {
+    struct file *f = 0;
+
+    if (sf->ref < 1)
+        panic("swapfile_unref");
+    if (--sf->ref == 0) {
+        f = sf->f;
+        sf->f = 0;
+    }
+    return f;
+}
+
+// Drop the owner's reference to sf.
+void
+swapfile_put(struct swapfile *sf) {
+    struct file *f;
+
+    acquire(&swaptable.lock);
+    f = swapfile_unref(sf);
+    release(&swaptable.lock);
+    if (f)
+        fileclose(f);
+}
+
+// Take another reference to a slot that is in use.
+void
+swap_slot_get(struct swapfile *sf, int slot) {
+    acquire(&swaptable.lock);
+    if (sf->slotref[slot] == 0)
+        panic("swap_slot_get");
+    sf->slotref[slot]++;
+    sf->ref++;
+    release(&swaptable.lock);
+}
+
+// Drop a reference to a slot, freeing it with the last one.
+void
+swap_slot_put(struct swapfile *sf, int slot) {
+    struct file *f;
+
+    acquire(&swaptable.lock);
+    if (sf->slotref[slot] == 0)
+        panic("swap_slot_put");
+    if (--sf->slotref[slot] == 0)
+        sf->bitmap &= ~(1U << slot);
+    f = swapfile_unref(sf);
+    release(&swaptable.lock);
+    if (f)
+        fileclose(f);
+}
+
+// Is a slot referenced by more than one page?
+static int
+swap_slot_shared(struct swapfile *sf, int slot) {
+    int r;
+
+    acquire(&swaptable.lock);
+    r = sf->slotref[slot] > 1;
+    release(&swaptable.lock);
+    return r;
+}
+
 // Creates a new swap file for a given process p. Requires p->pid to be correctly initiated
 //return 0 on success
 int
 createSwapFile(struct proc *p) {
     char path[DIGITS];
+    struct swapfile *sf;
+    struct file *f;
+
     memmove(path, "/.swap", 6);
     itoa(p->pid, path + 6);
 
@@ -749,100 +1363,333 @@ createSwapFile(struct proc *p) {
 
     struct inode *in = create(path, T_FILE, 0, 0);
     iunlock(in);
-    p->swapFile = filealloc();
-    if (p->swapFile == 0)
+    f = filealloc();
+    if (f == 0)
         panic("no slot for files on /store");
 
-    p->swapFile->ip = in;
-    p->swapFile->type = FD_INODE;
-    p->swapFile->off = 0;
-    p->swapFile->readable = O_WRONLY;
-    p->swapFile->writable = O_RDWR;
+    f->ip = in;
+    f->type = FD_INODE;
+    f->off = 0;
+    f->readable = O_WRONLY;
+    f->writable = O_RDWR;
     end_op();
-    return 0;
+
+    acquire(&swaptable.lock);
+    for (sf = swaptable.swapfile; sf < &swaptable.swapfile[NSWAPFILE]; sf++) {
+        if (sf->ref == 0) {
+            memset(sf, 0, sizeof(*sf));
+            sf->f = f;
+            sf->ref = 1;
+            release(&swaptable.lock);
+            p->swap = sf;
+            return 0;
+        }
+    }
+    panic("createSwapFile: no swapfile");
 }
 
 //Writes size bytes from buffer to the fileOffset index in the given process p swap file
 //return as sys_write (-1 when error)
 int
 writeToSwapFile(struct proc *p, char *buffer, uint placeOnFile, uint size) {
-    p->swapFile->off = placeOnFile;
-    int num_of_write_bits = kfilewrite(p->swapFile, (uint64) buffer, size);
+    uint t0 = ticks;
+    p->swap->f->off = placeOnFile;
+    int num_of_write_bits = kfilewrite(p->swap->f, (uint64) buffer, size);
+    if (num_of_write_bits > 0 && PGROUNDUP(p->swap->f->off) / PGSIZE > p->swap->backed)
+        p->swap->backed = PGROUNDUP(p->swap->f->off) / PGSIZE;
+    if (num_of_write_bits > 0)
+        p->pgstat.write_bytes += num_of_write_bits;
+    p->pgstat.io_ticks += ticks - t0;
     return num_of_write_bits;
 }
 
+// Read size bytes at placeOnFile of swap file sf for p. The file
+// may be shared with other processes, so its offset isn't used.
+static int
+swap_read(struct proc *p, struct swapfile *sf, char *buffer, uint placeOnFile, uint size) {
+    uint t0 = ticks;
+    int r;
+
+    ilock(sf->f->ip);
+    r = readi(sf->f->ip, 0, (uint64) buffer, placeOnFile, size);
+    iunlock(sf->f->ip);
+    if (r > 0)
+        p->pgstat.read_bytes += r;
+    p->pgstat.io_ticks += ticks - t0;
+    return r;
+}
+
 // Reads size bytes into buffer from the fileOffset index in the given process p swap file
 // return as sys_read (-1 when error)
 int
 readFromSwapFile(struct proc *p, char *buffer, uint placeOnFile, uint size) {
-    p->swapFile->off = placeOnFile;
-    int num_of_read_bits = kfileread(p->swapFile, (uint64) buffer, size);
-    return num_of_read_bits;
+    return swap_read(p, p->swap, buffer, placeOnFile, size);
 }
 
+// Give the child p_target of a fork the parent's swapped-out pages.
+// p_target's file_pages[] is already a copy of p_source's; each
+// entry gets a reference to the parent's slot rather than a copy.
+// Only when the parent's file is too full to share safely are its
+// own slots copied into the child's file.
 void copy_swap_file(struct proc *p_source, struct proc *p_target) {
     if (p_source->pid < 3)
         return;
-    char* buffer = kalloc();
-    int result;
-    for (int i = 0; i < MAX_TOTAL_PAGES - MAX_PYSC_PAGES; i++) {
-        if (p_source->file_pages[i].state == P_USED) {
-            result = readFromSwapFile(p_source, buffer, PGSIZE * i, PGSIZE);
-            if (result != PGSIZE){
-                printf("CopySwapFile readFromSwapFile error, read: %d bits\n",result);
-            }
+    struct swapfile *own = p_source->swap;
+    char *buffer = 0;
+    int share, result, slot;
 
-            result = writeToSwapFile(p_target, buffer, PGSIZE * i, PGSIZE);
-            if ( result != PGSIZE){
-                printf("CopySwapFile writeToSwapFile error, write: %d bits\n",result);
-            }
+    acquire(&swaptable.lock);
+    share = num_of_ones(own->bitmap) <= SWAP_FILE_SLOTS - MAX_SWAP_PAGES;
+    release(&swaptable.lock);
+
+    // resident pages keep no slot references in the child.
+    for (int i = 0; i < MAX_PYSC_PAGES; i++)
+        p_target->memory_pages[i].swap = 0;
+
+    for (int i = 0; i < MAX_SWAP_PAGES; i++) {
+        struct page_metadata_struct *pg = &p_target->file_pages[i];
+        if (pg->state != P_USED)
+            continue;
+        if (pg->swap != own || share) {
+            swap_slot_get(pg->swap, pg->slot);
+            continue;
+        }
+        if (buffer == 0 && (buffer = kalloc()) == 0)
+            panic("copy_swap_file: kalloc");
+        result = swap_read(p_source, own, buffer, PGSIZE * pg->slot, PGSIZE);
+        if (result != PGSIZE){
+            printf("CopySwapFile readFromSwapFile error, read: %d bits\n",result);
         }
+        pg->swap = 0; // not a neighbour for swap_slot_alloc() yet
+        if ((slot = swap_slot_alloc(p_target, pg->user_page_VA, -1)) < 0)
+            panic("copy_swap_file: child swap file full");
+        result = writeToSwapFile(p_target, buffer, PGSIZE * slot, PGSIZE);
+        if ( result != PGSIZE){
+            printf("CopySwapFile writeToSwapFile error, write: %d bits\n",result);
+        }
+        pg->swap = p_target->swap;
+        pg->slot = slot;
     }
-    kfree(buffer);
+    if (buffer)
+        kfree(buffer);
 }
 
-int get_free_file_index(struct proc *p) {
-    int max_page_num = (MAX_TOTAL_PAGES - MAX_PYSC_PAGES);
-    for (int i = 0; i < max_page_num; i++) {
+// Drop every slot reference held by p's pages, as when its
+// memory image goes away.
+void
+swap_release_pages(struct proc *p) {
+    for (int i = 0; i < MAX_PYSC_PAGES; i++) {
+        if (p->memory_pages[i].state == P_USED && p->memory_pages[i].swap) {
+            swap_slot_put(p->memory_pages[i].swap, p->memory_pages[i].slot);
+            p->memory_pages[i].swap = 0;
+        }
+    }
+    for (int i = 0; i < MAX_SWAP_PAGES; i++) {
+        if (p->file_pages[i].state == P_USED && p->file_pages[i].swap) {
+            swap_slot_put(p->file_pages[i].swap, p->file_pages[i].slot);
+            p->file_pages[i].swap = 0;
+        }
+    }
+}
+
+// Drop the slots that resident pages keep for a clean re-eviction.
+// Returns how many were dropped.
+static int
+swap_drop_retained(struct proc *p) {
+    int n = 0;
+    for (int i = 0; i < MAX_PYSC_PAGES; i++) {
+        if (p->memory_pages[i].state == P_USED && p->memory_pages[i].swap) {
+            swap_slot_put(p->memory_pages[i].swap, p->memory_pages[i].slot);
+            p->memory_pages[i].swap = 0;
+            n++;
+        }
+    }
+    return n;
+}
+
+// Swap slot allocator.
+//
+// sf->bitmap has a bit per slot in use. A slot is only handed out
+// below sf->backed (the file's current length in slots) or right
+// at its end, since writei() can't leave holes. Pages whose VAs are
+// adjacent are put in adjacent slots when possible, and the file
+// is trimmed once enough slots at its end are free.
+
+// Return the slot of p's own swap file holding user_page_VA, or -1.
+static int
+swap_slot_of(struct proc *p, uint64 user_page_VA) {
+    for (int i = 0; i < MAX_SWAP_PAGES; i++) {
+        if (p->file_pages[i].state == P_USED && p->file_pages[i].swap == p->swap &&
+            p->file_pages[i].user_page_VA == user_page_VA)
+            return p->file_pages[i].slot;
+    }
+    return -1;
+}
+
+static int
+swap_slot_usable(struct swapfile *sf, int slot) {
+    return slot >= 0 && slot < SWAP_FILE_SLOTS && slot <= sf->backed &&
+           (sf->bitmap & (1U << slot)) == 0;
+}
+
+// One past the highest slot in use.
+int
+swap_slots_top(struct swapfile *sf) {
+    int top = SWAP_FILE_SLOTS;
+    while (top > 0 && (sf->bitmap & (1U << (top - 1))) == 0)
+        top--;
+    return top;
+}
+
+// Allocate a slot in p's own swap file for user_page_VA. Prefer
+// the slot next to the one holding a neighbouring page, then the
+// slot after prev (the previous page of the same batch, or -1),
+// then the lowest free slot. Returns the slot, or -1 if the file
+// is full.
+int
+swap_slot_alloc(struct proc *p, uint64 user_page_VA, int prev) {
+    struct swapfile *sf = p->swap;
+    int below = swap_slot_of(p, user_page_VA - PGSIZE);
+    int above = swap_slot_of(p, user_page_VA + PGSIZE);
+    int s;
+
+    acquire(&swaptable.lock);
+    if ((sf->bitmap & SWAP_SLOTS_MASK) == SWAP_SLOTS_MASK) {
+        release(&swaptable.lock);
+        return -1;
+    }
+    if (!(below >= 0 && swap_slot_usable(sf, s = below + 1)) &&
+        !(above >= 0 && swap_slot_usable(sf, s = above - 1)) &&
+        !(prev >= 0 && swap_slot_usable(sf, s = prev + 1))) {
+        for (s = 0; sf->bitmap & (1U << s); s++)
+            ;
+    }
+    sf->bitmap |= 1U << s;
+    sf->slotref[s] = 1;
+    sf->ref++;
+    release(&swaptable.lock);
+    return s;
+}
+
+// Free slots below the highest used one: a measure of how
+// fragmented the swap file is.
+int
+swap_fragmentation(struct swapfile *sf) {
+    int holes = 0;
+    int top = swap_slots_top(sf);
+    for (int i = 0; i < top; i++) {
+        if ((sf->bitmap & (1U << i)) == 0)
+            holes++;
+    }
+    return holes;
+}
+
+// Give back the disk blocks of unused slots at the end of p's
+// swap file. Must not be called inside a transaction.
+void
+swap_file_trim(struct proc *p) {
+    struct swapfile *sf = p->swap;
+    struct inode *ip;
+    int top;
+
+    if (sf == 0)
+        return;
+    acquire(&swaptable.lock);
+    top = swap_slots_top(sf);
+    release(&swaptable.lock);
+    if (sf->backed - top < SWAP_TRIM_SLOTS)
+        return;
+    ip = sf->f->ip;
+    begin_op();
+    ilock(ip);
+    itruncate(ip, top * PGSIZE);
+    iunlock(ip);
+    end_op();
+    sf->backed = top;
+}
+
+static int
+get_free_file_index(struct proc *p) {
+    for (int i = 0; i < MAX_SWAP_PAGES; i++) {
         if (p->file_pages[i].state == P_UNUSED)
             return i;
     }
     return -1; // file is full
 }
 
-//static char buff[PGSIZE];
-
-int write_page_to_file(struct proc *p, uint64 user_page_VA, pagetable_t pagetable) {
-    int free_index = get_free_file_index(p);
-    pte_t *pte = walk(pagetable, user_page_VA,0);
-    uint64 user_page_pa = PTE2PA(*pte);
-    int result = writeToSwapFile(p, (char *) user_page_pa, PGSIZE * free_index, PGSIZE);
-    if (result == -1)
-        return -1;
-    //if reached here - data was successfully placed in file need to update meta_data
-    p->file_pages[free_index].state = P_USED;
-    p->file_pages[free_index].user_page_VA = user_page_VA;
-//    p->file_pages[free_index].pagetable = pagetable;
-    p->file_pages[free_index].page_order = 0;
-    p->pages_in_file_counter++;
-    p->pages_in_memory_counter--;
-//    printf("PID: %d in write_page_to_file(): added page num: %d addr: %p to file\n",p->pid,user_page_VA / 4096,user_page_VA);
+// Move the n resident pages described by pages[] (copies of their
+// memory_pages entries) of pagetable, in the frames pas[], to swap.
+// Their PTEs are already paged out, with PTE_D kept. A page that still
+// holds the slot it was read from and hasn't been written since
+// goes back to that slot without any I/O. The others are written
+// to p's own file; pages of one batch, and pages next to already
+// swapped neighbours, go to consecutive slots when possible.
+// return -1 on error
+int write_pages_to_file(struct proc *p, struct page_metadata_struct *pages, uint64 *pas, int n, pagetable_t pagetable) {
+    int result = 0;
+    int slot = -1;
+    for (int i = 0; i < n; i++) {
+        int index = get_free_file_index(p);
+        if (index < 0)
+            return -1;
+        pte_t *pte = walk(pagetable, pages[i].user_page_VA, 0);
+        struct page_metadata_struct *pg = &p->file_pages[index];
+        if (pages[i].swap && (*pte & PTE_D) == 0) {
+            // clean: the slot still holds the page's contents
+            pg->swap = pages[i].swap;
+            pg->slot = pages[i].slot;
+            p->pgstat.clean_outs++;
+            result = PGSIZE;
+        } else {
+            if (pages[i].swap)
+                swap_slot_put(pages[i].swap, pages[i].slot);
+            slot = swap_slot_alloc(p, pages[i].user_page_VA, slot);
+            if (slot < 0 && swap_drop_retained(p) > 0)
+                slot = swap_slot_alloc(p, pages[i].user_page_VA, -1);
+            if (slot < 0)
+                return -1; // file is full
+            result = writeToSwapFile(p, (char *) pas[i], PGSIZE * slot, PGSIZE);
+            if (result == -1) {
+                swap_slot_put(p->swap, slot);
+                return -1;
+            }
+            pg->swap = p->swap;
+            pg->slot = slot;
+        }
+        //if reached here - data was successfully placed in file need to update meta_data
+        pg->state = P_USED;
+        pg->user_page_VA = pages[i].user_page_VA;
+        pg->page_order = 0;
+        p->pgstat.page_outs++;
+        p->pages_in_file_counter++;
+        p->pages_in_memory_counter--;
+    }
     return result;
 }
 
+// Read the swapped-out page user_page_VA into buff and make it
+// memory_pages[memory_index]. A slot shared with another process
+// stays referenced by the resident page, see write_pages_to_file().
 int read_page_from_file(struct proc *p, int memory_index, uint64 user_page_VA, char *buff) {
     int max_page_num = (MAX_TOTAL_PAGES - MAX_PYSC_PAGES);
     int result;
     for (int i = 0; i < max_page_num; i++) {
-        if (p->file_pages[i].user_page_VA == user_page_VA) {
-            result = readFromSwapFile(p, buff, i * PGSIZE, PGSIZE);
+        struct page_metadata_struct *pg = &p->file_pages[i];
+        if (pg->state == P_USED && pg->user_page_VA == user_page_VA) {
+            result = swap_read(p, pg->swap, buff, pg->slot * PGSIZE, PGSIZE);
             if (result == -1){
 //                panic("read_page_from_file() - error in read\n");
                 break; //error in read
             }
-            p->memory_pages[memory_index] = p->file_pages[i];
+            p->memory_pages[memory_index] = *pg;
             p->memory_pages[memory_index].page_order = p->page_order_counter++;
-            p->file_pages[i].state = P_UNUSED;
+            if (!swap_slot_shared(pg->swap, pg->slot)) {
+                swap_slot_put(pg->swap, pg->slot);
+                p->memory_pages[memory_index].swap = 0;
+            }
+            pg->state = P_UNUSED;
+            pg->swap = 0;
+            p->pgstat.page_ins++;
             p->pages_in_file_counter--;
             p->pages_in_memory_counter++;
 //            printf("PID: %d in read_page_from_file(): added page num: %d addr: %p to ram\n",p->pid,user_page_VA / 4096,user_page_VA);
@@ -851,4 +1698,4 @@ int read_page_from_file(struct proc *p, int memory_index, uint64 user_page_VA, c
     }
     //if reached here - physical address given is not paged out (not found)
     return -1;
-}
\ No newline at end of file
+}
@@ -0,0 +1,124 @@
+// Futexes: sleeping on a word of user memory.
+//
+// futex(addr, FUTEX_WAIT, val) sleeps if the int at addr still
+// holds val; futex(addr, FUTEX_WAKE, n) wakes up to n of the
+// processes sleeping on addr. Locks built on this in ulib.c
+// only make a system call when they have to wait, or when
+// someone waits for them.
+//
+// A futex is identified by its user address in an address
+// space, so the threads of a process share it, and it stays
+// the same when its page is swapped out and back in. Sleepers
+// are kept in NFUTEX queues, chosen by hashing the address.
+// Checking the word and going to sleep are atomic with respect
+// to FUTEX_WAKE, since both happen under the queue's lock. The
+// word is read under vmlock() too, so that no other thread can
+// page it out and free its frame meanwhile.
+//
+// Lock order: vmlock(), then a futex queue's lock, then vmlk
+// and the locks of sleep().
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+#include "futex.h"
+
+struct futexq {
+    struct spinlock lock;
+    struct proc *head;  // sleepers, linked by fx_next
+};
+
+static struct futexq futexq[NFUTEX];
+
+#define FUTEX_HASH(vm, addr) ((((uint64) (vm)) ^ ((addr) >> 2)) % NFUTEX)
+
+void
+futexinit(void) {
+    for (int i = 0; i < NFUTEX; i++)
+        initlock(&futexq[i].lock, "futex");
+}
+
+// Sleep on addr if it holds val. Returns 0 when woken up,
+// -1 if the word had changed, addr is bad, or we were killed.
+static int
+futex_wait(uint64 addr, int val) {
+    struct proc *p = myproc();
+    struct proc *vm = p->leader;
+    struct futexq *q = &futexq[FUTEX_HASH(vm, addr)];
+    struct proc **pp;
+    uint64 pa;
+    int v;
+
+    vmlock(vm);
+    if (page_in_file(addr, vm->pagetable))
+        get_page_from_file(addr);
+    if ((pa = walkaddr(vm->pagetable, addr)) == 0) {
+        vmunlock(vm);
+        return -1;
+    }
+    acquire(&q->lock);
+    v = *(int *) (pa + (addr & (PGSIZE - 1)));
+    vmunlock(vm);
+    if (v != val) {
+        release(&q->lock);
+        return -1;
+    }
+    for (pp = &q->head; *pp; pp = &(*pp)->fx_next)
+        ;
+    p->fx_addr = addr;
+    p->fx_q = q;
+    p->fx_next = 0;
+    *pp = p;
+    sleep(&p->fx_addr, &q->lock);
+
+    // still queued if kill() woke us.
+    if (p->fx_q) {
+        for (pp = &q->head; *pp != p; pp = &(*pp)->fx_next)
+            ;
+        *pp = p->fx_next;
+        p->fx_q = 0;
+    }
+    release(&q->lock);
+    return p->killed ? -1 : 0;
+}
+
+// Wake up to n processes sleeping on addr, in the order they
+// went to sleep. Returns the number woken.
+static int
+futex_wake(uint64 addr, int n) {
+    struct proc *vm = myproc()->leader;
+    struct futexq *q = &futexq[FUTEX_HASH(vm, addr)];
+    struct proc *w, **pp;
+    int woken = 0;
+
+    acquire(&q->lock);
+    for (pp = &q->head; (w = *pp) != 0 && woken < n;) {
+        if (w->leader == vm && w->fx_addr == addr) {
+            *pp = w->fx_next;
+            w->fx_q = 0;
+            wakeup(&w->fx_addr);
+            woken++;
+            continue;
+        }
+        pp = &w->fx_next;
+    }
+    release(&q->lock);
+    return woken;
+}
+
+int
+futex(uint64 addr, int op, int val) {
+    if (addr % sizeof(int) != 0 || addr >= MAXVA)
+        return -1;
+    switch (op) {
+    case FUTEX_WAIT:
+        return futex_wait(addr, val);
+    case FUTEX_WAKE:
+        return futex_wake(addr, val);
+    }
+    return -1;
+}
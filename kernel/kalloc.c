@@ -21,12 +21,13 @@ struct run {
 struct {
   struct spinlock lock;
   struct run *freelist;
+  int nfree;          // pages on freelist
 } kmem;
 
 void
 kinit()
 {
-  initlock(&kmem.lock, "kmem");
+  initticketlock(&kmem.lock, "kmem");
   freerange(end, (void*)PHYSTOP);
 }
 
@@ -59,24 +60,48 @@ kfree(void *pa)
   acquire(&kmem.lock);
   r->next = kmem.freelist;
   kmem.freelist = r;
+  kmem.nfree++;
   release(&kmem.lock);
 }
 
-// Allocate one 4096-byte page of physical memory.
-// Returns a pointer that the kernel can use.
-// Returns 0 if the memory cannot be allocated.
-void *
-kalloc(void)
+// Take a page off the free list, unless that would leave
+// fewer than keep pages on it.
+static void *
+kalloc_take(int keep)
 {
-  struct run *r;
+  struct run *r = 0;
 
   acquire(&kmem.lock);
-  r = kmem.freelist;
-  if(r)
+  if(kmem.nfree > keep){
+    r = kmem.freelist;
     kmem.freelist = r->next;
+    kmem.nfree--;
+  }
   release(&kmem.lock);
 
   if(r)
     memset((char*)r, 5, PGSIZE); // fill with junk
   return (void*)r;
 }
+
+// Allocate one 4096-byte page of physical memory.
+// Returns a pointer that the kernel can use.
+// Returns 0 if the memory cannot be allocated.
+void *
+kalloc(void)
+{
+  void *r;
+
+  // out of memory: take back what the buffer cache can spare.
+  if((r = kalloc_take(0)) == 0 && bshrink(0) > 0)
+    r = kalloc_take(0);
+  return r;
+}
+
+// Allocate a page for the buffer cache to grow into. Unlike
+// kalloc(), leave the last KMEM_RESERVE pages to others.
+void *
+kalloc_cache(void)
+{
+  return kalloc_take(KMEM_RESERVE);
+}
@@ -0,0 +1,16 @@
+// Statistics of the locks with one name, from lockstat().
+// Times are in timer cycles.
+struct lockinfo {
+  char name[16];       // Lock name
+  int sleep;           // 1 for sleep locks, 0 for spinlocks
+  int nlocks;          // Locks initialized with this name
+  uint64 acquires;     // Times acquired
+  uint64 contended;    // Acquires that had to wait
+  uint64 waittime;     // Time spent waiting, spinning or asleep
+  uint64 maxhold;      // Longest time held
+};
+
+// lockbench() histogram buckets: bucket 0 counts acquires
+// that didn't wait, bucket b > 0 ones that waited 2^(b-1) to
+// 2^b - 1 timer cycles.
+#define NLOCKBENCH 32
@@ -21,8 +21,28 @@
 // But if it thinks the log is close to running out, it
 // sleeps until the last outstanding end_op() commits.
 //
+// Group commit: once a commit has copied its transaction's
+// blocks into the log, new FS system calls start filling the
+// next transaction while the commit writes the header. They
+// all go into that transaction, which the committing process
+// also commits if they are done by then, so a stream of
+// system calls from many processes commits in a few large
+// transactions rather than many small ones.
+//
+// Checkpointing: the log has two areas, which transactions
+// commit into in turn. Committing writes only the log and
+// its header; the checkpoint kernel process then installs
+// the blocks at their home locations and erases the area,
+// while the next transaction commits into the other area.
+// The logged blocks stay pinned in the cache until they are
+// installed, since their home locations are stale till then.
+// Installing writes the logged copies straight to the disk,
+// leaving the cached blocks, which a later transaction may
+// have changed, alone. Headers carry a sequence number, so
+// recovery installs two committed areas in commit order.
+//
 // The log is a physical re-do log containing disk blocks.
-// The on-disk log format:
+// The on-disk log format, for each of the two areas:
 //   header block, containing block #s for block A, B, C, ...
 //   block A
 //   block B
@@ -34,22 +54,37 @@
 // and to keep track in memory of logged block# before commit.
 struct logheader {
   int n;
+  uint seq;   // commit order
   int block[LOGSIZE];
 };
 
+struct logarea {
+  int start;            // header block
+  int committed;        // holds a transaction not yet installed
+  struct logheader lh;  // that transaction
+};
+
 struct log {
   struct spinlock lock;
-  int start;
-  int size;
+  int size;        // data blocks a transaction may log
   int outstanding; // how many FS sys calls are executing.
-  int committing;  // in commit(), please wait.
+  int committing;  // a process is in commit().
+  int copying;     // commit() is copying blocks to the log, please wait.
   int dev;
-  struct logheader lh;
+  uint seq;        // of the next commit
+  int next;        // area the next commit goes to
+  struct logheader lh;   // the transaction being filled
+  struct logarea area[2];
 };
 struct log log;
 
+// blocks on their way from the log to their home locations,
+// outside the buffer cache. used by the checkpointer alone.
+static struct buf homebuf[NINSTALL];
+
 static void recover_from_log(void);
-static void commit();
+static void commit(void);
+static void checkpoint(void);
 
 void
 initlog(int dev, struct superblock *sb)
@@ -58,40 +93,66 @@ initlog(int dev, struct superblock *sb)
     panic("initlog: too big logheader");
 
   initlock(&log.lock, "log");
-  log.start = sb->logstart;
-  log.size = sb->nlog;
+  // Up to three transactions' blocks are pinned in the cache
+  // at once: the one being filled and one in each area. The
+  // NBUF buffers the cache always has must hold them, with
+  // room to spare for the log's own buffers and the FS calls.
+  // LOGSIZE is sized so; a bigger log is left partly unused.
+  log.size = sb->nlog/2 - 1;
+  if (log.size > LOGSIZE)
+    log.size = LOGSIZE;
+  if (log.size < MAXOPBLOCKS)
+    panic("initlog: log too small");
+  log.area[0].start = sb->logstart;
+  log.area[1].start = sb->logstart + sb->nlog/2;
   log.dev = dev;
   recover_from_log();
+  kproc(checkpoint, "checkpoint");
 }
 
-// Copy committed blocks from log to their home location
+// Copy committed blocks from log to their home location,
+// NINSTALL at a time, the writes of each batch all at once.
 static void
-install_trans(int recovering)
+install_trans(struct logarea *a, int recovering)
 {
-  int tail;
+  struct buf *bs[NINSTALL];
+  int tail, i, n;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
-    struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
-    memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
-    bwrite(dbuf);  // write dst to disk
-    if(recovering == 0)
-      bunpin(dbuf);
-    brelse(lbuf);
-    brelse(dbuf);
+  for (tail = 0; tail < a->lh.n; tail += n) {
+    n = a->lh.n - tail;
+    if (n > NINSTALL)
+      n = NINSTALL;
+    for (i = 0; i < n; i++) {
+      struct buf *lbuf = bread(log.dev, a->start+tail+i+1); // read log block
+      homebuf[i].dev = log.dev;
+      homebuf[i].blockno = a->lh.block[tail+i];
+      memmove(homebuf[i].data, lbuf->data, BSIZE);  // copy block to dst
+      brelse(lbuf);
+      bs[i] = &homebuf[i];
+    }
+    virtio_disk_rwv(bs, n, 1);  // write dst to disk
+    if(recovering == 0){
+      // they're safe on disk; the cache may drop them now.
+      for (i = 0; i < n; i++) {
+        struct buf *dbuf = bread(log.dev, a->lh.block[tail+i]);
+        bunpin(dbuf);
+        brelse(dbuf);
+      }
+    }
   }
 }
 
 // Read the log header from disk into the in-memory log header
 static void
-read_head(void)
+read_head(struct logarea *a)
 {
-  struct buf *buf = bread(log.dev, log.start);
+  struct buf *buf = bread(log.dev, a->start);
   struct logheader *lh = (struct logheader *) (buf->data);
   int i;
-  log.lh.n = lh->n;
-  for (i = 0; i < log.lh.n; i++) {
-    log.lh.block[i] = lh->block[i];
+  a->lh.n = lh->n;
+  a->lh.seq = lh->seq;
+  for (i = 0; i < a->lh.n; i++) {
+    a->lh.block[i] = lh->block[i];
   }
   brelse(buf);
 }
@@ -100,14 +161,15 @@ read_head(void)
 // This is the true point at which the
 // current transaction commits.
 static void
-write_head(void)
+write_head(struct logarea *a)
 {
-  struct buf *buf = bread(log.dev, log.start);
+  struct buf *buf = bread(log.dev, a->start);
   struct logheader *hb = (struct logheader *) (buf->data);
   int i;
-  hb->n = log.lh.n;
-  for (i = 0; i < log.lh.n; i++) {
-    hb->block[i] = log.lh.block[i];
+  hb->n = a->lh.n;
+  hb->seq = a->lh.seq;
+  for (i = 0; i < a->lh.n; i++) {
+    hb->block[i] = a->lh.block[i];
   }
   bwrite(buf);
   brelse(buf);
@@ -116,10 +178,22 @@ write_head(void)
 static void
 recover_from_log(void)
 {
-  read_head();
-  install_trans(1); // if committed, copy from log to disk
-  log.lh.n = 0;
-  write_head(); // clear the log
+  struct logarea *a = &log.area[0], *b = &log.area[1], *t;
+
+  read_head(a);
+  read_head(b);
+  if (a->lh.n > 0 && b->lh.n > 0 && (int)(b->lh.seq - a->lh.seq) < 0) {
+    t = a;  // b committed first
+    a = b;
+    b = t;
+  }
+  log.seq = (int)(b->lh.seq - a->lh.seq) > 0 ? b->lh.seq + 1 : a->lh.seq + 1;
+  install_trans(a, 1); // if committed, copy from log to disk
+  install_trans(b, 1);
+  a->lh.n = 0;
+  write_head(a); // clear the log
+  b->lh.n = 0;
+  write_head(b);
 }
 
 // called at the start of each FS system call.
@@ -128,9 +202,9 @@ begin_op(void)
 {
   acquire(&log.lock);
   while(1){
-    if(log.committing){
+    if(log.copying){
       sleep(&log, &log.lock);
-    } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
+    } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > log.size){
       // this op might exhaust log space; wait for commit.
       sleep(&log, &log.lock);
     } else {
@@ -142,7 +216,9 @@ begin_op(void)
 }
 
 // called at the end of each FS system call.
-// commits if this was the last outstanding operation.
+// commits if this was the last outstanding operation,
+// unless a commit is under way: that one will commit
+// this transaction after its own.
 void
 end_op(void)
 {
@@ -150,9 +226,9 @@ end_op(void)
 
   acquire(&log.lock);
   log.outstanding -= 1;
-  if(log.committing)
-    panic("log.committing");
-  if(log.outstanding == 0){
+  if(log.copying)
+    panic("log.copying");
+  if(log.outstanding == 0 && !log.committing){
     do_commit = 1;
     log.committing = 1;
   } else {
@@ -161,44 +237,117 @@ end_op(void)
     // the amount of reserved space.
     wakeup(&log);
   }
-  release(&log.lock);
 
-  if(do_commit){
+  while(do_commit){
+    // no FS system calls may start until the blocks
+    // are in the log.
+    log.copying = 1;
+    release(&log.lock);
+
     // call commit w/o holding locks, since not allowed
     // to sleep with locks.
     commit();
+
     acquire(&log.lock);
+    if(log.outstanding == 0 && log.lh.n > 0){
+      // the next transaction is done too; commit it.
+      continue;
+    }
     log.committing = 0;
+    do_commit = 0;
     wakeup(&log);
-    release(&log.lock);
   }
+  release(&log.lock);
 }
 
-// Copy modified blocks from cache to log.
+// Copy modified blocks from cache to log. The log blocks are
+// consecutive, so they go to the disk as one request.
 static void
-write_log(void)
+write_log(struct logarea *a)
 {
+  struct buf *to[LOGSIZE];
   int tail;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start+tail+1); // log block
-    struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
-    memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
+  for (tail = 0; tail < a->lh.n; tail++) {
+    to[tail] = bfresh(log.dev, a->start+tail+1); // log block
+    struct buf *from = bread(log.dev, a->lh.block[tail]); // cache block
+    memmove(to[tail]->data, from->data, BSIZE);
     brelse(from);
-    brelse(to);
   }
+  virtio_disk_rwv(to, a->lh.n, 1);  // write the log
+  for (tail = 0; tail < a->lh.n; tail++)
+    brelse(to[tail]);
 }
 
+// Commit the transaction in log.lh, with log.copying set, into
+// the next log area, and hand it to the checkpointer. Clears
+// log.copying once the blocks are copied into the log.
 static void
-commit()
+commit(void)
 {
-  if (log.lh.n > 0) {
-    write_log();     // Write modified blocks from cache to log
-    write_head();    // Write header to disk -- the real commit
-    install_trans(0); // Now install writes to home locations
-    log.lh.n = 0;
-    write_head();    // Erase the transaction from the log
+  struct logarea *a = &log.area[log.next];
+  int n;
+
+  acquire(&log.lock);
+  while (a->committed)   // still being installed
+    sleep(&log, &log.lock);
+  n = log.lh.n;
+  if (n > 0) {
+    memmove(&a->lh, &log.lh, sizeof(log.lh));
+    a->lh.seq = log.seq++;
+  }
+  log.lh.n = 0;
+  release(&log.lock);
+
+  if (n == 0) {
+    acquire(&log.lock);
+    log.copying = 0;
+    wakeup(&log);
+    release(&log.lock);
+    return;
+  }
+
+  write_log(a);     // Write modified blocks from cache to log
+
+  acquire(&log.lock);
+  log.copying = 0;
+  wakeup(&log);
+  release(&log.lock);
+
+  write_head(a);    // Write header to disk -- the real commit
+
+  acquire(&log.lock);
+  a->committed = 1;
+  log.next ^= 1;
+  wakeup(&log.area);
+  release(&log.lock);
+}
+
+// The checkpoint kernel process: install each committed
+// transaction at its home locations, in commit order, and
+// erase it from its log area so the area can be reused.
+static void
+checkpoint(void)
+{
+  struct logarea *a;
+  int i = 0;
+
+  for (;;) {
+    a = &log.area[i];
+    acquire(&log.lock);
+    while (!a->committed)
+      sleep(&log.area, &log.lock);
+    release(&log.lock);
+
+    install_trans(a, 0); // Now install writes to home locations
+    a->lh.n = 0;
+    write_head(a);       // Erase the transaction from the log
+
+    acquire(&log.lock);
+    a->committed = 0;
+    wakeup(&log);
+    release(&log.lock);
+    i ^= 1;
   }
 }
 
@@ -214,22 +363,23 @@ commit()
 void
 log_write(struct buf *b)
 {
+  struct logheader *lh = &log.lh;
   int i;
 
   acquire(&log.lock);
-  if (log.lh.n >= LOGSIZE || log.lh.n >= log.size - 1)
+  if (lh->n >= log.size)
     panic("too big a transaction");
   if (log.outstanding < 1)
     panic("log_write outside of trans");
 
-  for (i = 0; i < log.lh.n; i++) {
-    if (log.lh.block[i] == b->blockno)   // log absorbtion
+  for (i = 0; i < lh->n; i++) {
+    if (lh->block[i] == b->blockno)   // log absorbtion
       break;
   }
-  log.lh.block[i] = b->blockno;
-  if (i == log.lh.n) {  // Add new block to log?
+  lh->block[i] = b->blockno;
+  if (i == lh->n) {  // Add new block to log?
     bpin(b);
-    log.lh.n++;
+    lh->n++;
   }
   release(&log.lock);
 }
@@ -21,12 +21,15 @@ main()
     kvminithart();   // turn on paging
     procinit();      // process table
     trapinit();      // trap vectors
+    timerqinit();    // per-hart timers
+    futexinit();     // futex queues
     trapinithart();  // install kernel trap vector
     plicinit();      // set up interrupt controller
     plicinithart();  // ask PLIC for device interrupts
     binit();         // buffer cache
     iinit();         // inode cache
     fileinit();      // file table
+    swapinit();      // swap file table
     virtio_disk_init(); // emulated hard disk
     userinit();      // first user process
     __sync_synchronize();
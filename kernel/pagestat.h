@@ -0,0 +1,24 @@
+// Paging policy the kernel was built with (pagestat.policy).
+#define PG_NONE   0
+#define PG_SCFIFO 1
+#define PG_NFUA   2
+#define PG_LAPA   3
+#define PG_DEBUG  4
+
+struct pagestat {
+  int policy;          // PG_* paging policy
+  int resident;        // Pages in memory
+  int swapped;         // Pages in the swap file
+  uint faults;         // Page faults on swapped-out pages
+  uint tlbfaults;      // Faults retried on a stale TLB entry
+  uint pageins;        // Pages read back from swap
+  uint pageouts;       // Pages evicted to swap
+  uint cleanouts;      // Evictions that needed no write
+  uint64 readbytes;    // Bytes read from swap
+  uint64 writebytes;   // Bytes written to swap
+  uint ioticks;        // Ticks spent waiting on swap I/O
+  uint scans;          // Paging policy passes for a victim
+  uint scanned;        // Pages the policy examined doing so
+  int swapslots;       // Swap file slots up to the highest used one
+  int swapholes;       // Free slots among those
+};
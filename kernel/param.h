@@ -1,15 +1,40 @@
 #define NPROC        64  // maximum number of processes
 #define NCPU          8  // maximum number of CPUs
+#define NTHREAD       8  // maximum threads sharing an address space
+#define NMLFQ         3  // scheduler priority levels
+#define MLFQ_QUANTUM TICK_INTERVAL // default level 0 time slice (cycles), doubling per level
+#define MLFQ_QUANTUM_MIN 1000 // shortest level 0 time slice quantum() sets (microseconds)
+#define MLFQ_BOOST  100  // ticks between raising every process to level 0
+#define NWAITQ       31  // wait queues sleeping processes are hashed into
+#define NFUTEX       31  // futex queues, hashed by user address
+#define NLOCKSTAT    64  // lock names LOCKSTAT keeps statistics for
+#define NTIMERWHEEL  32  // timer wheel slots per hart, one per tick
+#define TIMER_HZ  10000000 // CLINT timer frequency in qemu
+#define TICK_INTERVAL 1000000 // timer cycles per tick; about 1/10th second
+#define AGING_PERIOD TICK_INTERVAL // run time (cycles) between NFUA/LAPA aging sweeps
 #define NOFILE       16  // open files per process
 #define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
+#define NINODE       50  // initial in-memory i-nodes; more are added as needed
+#define NIHASH       31  // in-memory i-node hash buckets
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
-#define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
-#define FSSIZE       1000  // size of file system in blocks
+#define NINSTALL     16  // log blocks the checkpointer writes home at once
+#define NBUF         (MAXOPBLOCKS*16)  // initial size of disk block cache
+#define LOGSIZE      ((NBUF-NINSTALL-MAXOPBLOCKS)/3)  // max data blocks in a transaction; see initlog()
+#define NLOG         (2*(MAXOPBLOCKS*3+1))  // on-disk log blocks mkfs makes by default, both areas
+#define NBUFMAX      300  // most buffers the disk block cache can grow to
+#define KMEM_RESERVE 256  // free pages the block cache won't grow into
+#define NBUFHASH     13  // buffer cache hash buckets
+#define NREADAHEAD   8  // most blocks read ahead of a sequential reader
+#define NBMAP       32  // block addresses an inode caches from its indirect blocks
+#define NDCACHE     128  // directory name cache entries
+#define FSSIZE       4000  // size of file system in blocks
 #define MAXPATH      128   // maximum file path name
 #define MAX_PYSC_PAGES      16  // max num of pages in the physical memory
 #define MAX_TOTAL_PAGES     32 // total num of physical memory
+#define MAX_SWAP_PAGES      (MAX_TOTAL_PAGES - MAX_PYSC_PAGES) // max num of pages in the swap file
+#define SWAP_TRIM_SLOTS     4  // free slots at the end of a swap file before it is shrunk
+#define SWAP_FILE_SLOTS     (2*MAX_SWAP_PAGES) // slots per swap file, own pages plus ones shared by fork
+#define NSWAPFILE           (2*NPROC) // open swap files, including ones kept by children
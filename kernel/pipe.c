@@ -76,7 +76,7 @@ pipeclose(struct pipe *pi, int writable)
 int
 pipewrite(struct pipe *pi, uint64 addr, int n)
 {
-  int i = 0;
+  int i = 0, r;
   struct proc *pr = myproc();
 
   acquire(&pi->lock);
@@ -90,8 +90,16 @@ pipewrite(struct pipe *pi, uint64 addr, int n)
       sleep(&pi->nwrite, &pi->lock);
     } else {
       char ch;
-      if(copyin(pr->pagetable, &ch, addr + i, 1) == -1)
-        break;
+      if(copyin(pr->pagetable, &ch, addr + i, 1) == -1){
+        // it may be in swap, which copyin() only pages
+        // in when it can sleep: without pi->lock.
+        release(&pi->lock);
+        r = copyin(pr->pagetable, &ch, addr + i, 1);
+        acquire(&pi->lock);
+        if(r == -1)
+          break;
+        continue;
+      }
       pi->data[pi->nwrite++ % PIPESIZE] = ch;
       i++;
     }
@@ -105,7 +113,7 @@ pipewrite(struct pipe *pi, uint64 addr, int n)
 int
 piperead(struct pipe *pi, uint64 addr, int n)
 {
-  int i;
+  int i, r;
   struct proc *pr = myproc();
   char ch;
 
@@ -121,8 +129,14 @@ piperead(struct pipe *pi, uint64 addr, int n)
     if(pi->nread == pi->nwrite)
       break;
     ch = pi->data[pi->nread++ % PIPESIZE];
-    if(copyout(pr->pagetable, addr + i, &ch, 1) == -1)
-      break;
+    if(copyout(pr->pagetable, addr + i, &ch, 1) == -1){
+      // as in pipewrite().
+      release(&pi->lock);
+      r = copyout(pr->pagetable, addr + i, &ch, 1);
+      acquire(&pi->lock);
+      if(r == -1)
+        break;
+    }
   }
   wakeup(&pi->nwrite);  //DOC: piperead-wakeup
   release(&pi->lock);
@@ -5,6 +5,8 @@
 #include "spinlock.h"
 #include "proc.h"
 #include "defs.h"
+#include "pagestat.h"
+#include "rusage.h"
 
 
 struct cpu cpus[NCPU];
@@ -13,12 +15,20 @@ struct proc proc[NPROC];
 
 struct proc *initproc;
 
+// level 0 time slice in timer cycles; see quantum().
+uint64 sched_quantum = MLFQ_QUANTUM;
+
 int nextpid = 1;
 struct spinlock pid_lock;
 
 extern void forkret(void);
 
 static void freeproc(struct proc *p);
+static void thread_exit(struct proc *p);
+static void thread_killall(struct proc *p);
+static void runq_push(struct proc *p);
+static void setrunnable(struct proc *p);
+static void waitqinit(void);
 
 extern char trampoline[]; // trampoline.S
 
@@ -48,12 +58,18 @@ proc_mapstacks(pagetable_t kpgtbl) {
 void
 procinit(void) {
     struct proc *p;
+    struct cpu *c;
 
     initlock(&pid_lock, "nextpid");
     initlock(&wait_lock, "wait_lock");
+    for (c = cpus; c < &cpus[NCPU]; c++)
+        initticketlock(&c->rq.lock, "runq");
+    waitqinit();
     for (p = proc; p < &proc[NPROC]; p++) {
-        initlock(&p->lock, "proc");
+        initticketlock(&p->lock, "proc");
+        initlock(&p->vmlk, "vmlock");
         p->kstack = KSTACK((int) (p - proc));
+        p->asid = (int) (p - proc) + 1; // ASID 0 is the kernel's
     }
 }
 
@@ -85,6 +101,14 @@ myproc(void) {
     return p;
 }
 
+// Return the process owning the current address space:
+// the current process, or its leader if it is a thread.
+struct proc *
+myvm(void) {
+    struct proc *p = myproc();
+    return p ? p->leader : 0;
+}
+
 int
 allocpid() {
     int pid;
@@ -99,10 +123,12 @@ allocpid() {
 
 // Look in the process table for an UNUSED proc.
 // If found, initialize state required to run in the kernel,
-// and return with p->lock held.
+// and return with p->lock held. A thread of leader gets only
+// a trapframe, which the caller maps; other processes get an
+// address space of their own.
 // If there are no free procs, or a memory allocation fails, return 0.
 static struct proc *
-allocproc(void) {
+allocproc(struct proc *leader) {
     struct proc *p;
 
     for (p = proc; p < &proc[NPROC]; p++) {
@@ -118,7 +144,13 @@ allocproc(void) {
     found:
     p->pid = allocpid();
     p->state = USED;
-
+    p->cpu = runq_least_loaded();
+    p->level = 0;
+    p->slice = 0;
+    p->epoch = ticks / MLFQ_BOOST;
+    p->utime = p->stime = p->ftime = 0;
+    p->aged = p->agetime = 0;
+    p->nvcsw = p->nivcsw = 0;
 
     // Allocate a trapframe page.
     if ((p->trapframe = (struct trapframe *) kalloc()) == 0) {
@@ -127,6 +159,16 @@ allocproc(void) {
         return 0;
     }
 
+    if (leader) {
+        p->leader = leader;
+        p->pagetable = leader->pagetable;
+        goto context;
+    }
+    p->leader = p;
+    p->tfslot = 0;
+    p->tfslots = 1;
+    p->nthreads = 1;
+
     // An empty user page table.
     p->pagetable = proc_pagetable(p);
     if (p->pagetable == 0) {
@@ -134,11 +176,16 @@ allocproc(void) {
         release(&p->lock);
         return 0;
     }
+    // the previous owner of this slot may have left entries
+    // tagged with our ASID in any hart's TLB.
+    tlb_flush_asid(p);
     if (p->pid > 2 && !is_none_policy()) {
         release(&p->lock);
         createSwapFile(p);
         acquire(&p->lock);
     }
+
+    context:
     // Set up new context to start executing at forkret,
     // which returns to user space.
     memset(&p->context, 0, sizeof(p->context));
@@ -156,9 +203,11 @@ freeproc(struct proc *p) {
     if (p->trapframe)
         kfree((void *) p->trapframe);
     p->trapframe = 0;
-    if (p->pagetable)
+    // a thread's page table is its leader's; see exit().
+    if (p->pagetable && p->leader == p)
         proc_freepagetable(p->pagetable, p->sz);
     p->pagetable = 0;
+    p->leader = 0;
     p->sz = 0;
     p->pid = 0;
     p->parent = 0;
@@ -221,11 +270,58 @@ uchar initcode[] = {
         0x00, 0x00, 0x00, 0x00
 };
 
+// A kernel process's very first scheduling by scheduler()
+// will swtch to kprocret.
+static void
+kprocret(void) {
+    // Still holding p->lock from scheduler.
+    release(&myproc()->lock);
+    myproc()->kfn();
+    panic("kproc returned");
+}
+
+// Start a kernel process running fn, which must not return.
+// It has no user memory and, like the swapper of old, pid 0,
+// so user processes keep their pids and can't kill it.
+void
+kproc(void (*fn)(void), char *name) {
+    struct proc *p;
+
+    for (p = proc; p < &proc[NPROC]; p++) {
+        acquire(&p->lock);
+        if (p->state == UNUSED)
+            goto found;
+        release(&p->lock);
+    }
+    panic("kproc");
+
+    found:
+    p->pid = 0;
+    p->state = USED;
+    p->cpu = runq_least_loaded();
+    p->level = 0;
+    p->slice = 0;
+    p->epoch = ticks / MLFQ_BOOST;
+    p->utime = p->stime = p->ftime = 0;
+    p->aged = p->agetime = 0;
+    p->nvcsw = p->nivcsw = 0;
+    p->leader = p;
+    p->kfn = fn;
+    safestrcpy(p->name, name, sizeof(p->name));
+
+    memset(&p->context, 0, sizeof(p->context));
+    p->context.ra = (uint64) kprocret;
+    p->context.sp = p->kstack + PGSIZE;
+
+    setrunnable(p);
+    release(&p->lock);
+}
+
 // Set up first user process.
 void
 userinit(void) {
     struct proc *p;
-    p = allocproc();
+    p = allocproc(0);
     initproc = p;
 
     // allocate one user page and copy init's instructions
@@ -240,17 +336,18 @@ userinit(void) {
     safestrcpy(p->name, "initcode", sizeof(p->name));
     p->cwd = namei("/");
 
-    p->state = RUNNABLE;
+    setrunnable(p);
 
     release(&p->lock);
 }
 
 // Grow or shrink user memory by n bytes.
 // Return 0 on success, -1 on failure.
+// Caller must hold vmlock(myvm()).
 int
 growproc(int n) {
     uint sz;
-    struct proc *p = myproc();
+    struct proc *p = myvm();
 
     sz = p->sz;
     if (n > 0) {
@@ -259,6 +356,8 @@ growproc(int n) {
         }
     } else if (n < 0) {
         sz = uvmdealloc(p->pagetable, sz, sz + n);
+        if (p->pid > 2 && !is_none_policy())
+            swap_file_trim(p);
     }
     p->sz = sz;
     return 0;
@@ -271,37 +370,46 @@ fork(void) {
     int i, pid;
     struct proc *np;
     struct proc *p = myproc();
+    struct proc *vm = p->leader;
+
+    // the address space must hold still while it is copied.
+    vmlock(vm);
 
     // Allocate process.
-    if ((np = allocproc()) == 0) {
+    if ((np = allocproc(0)) == 0) {
+        vmunlock(vm);
         return -1;
     }
 
     // Copy user memory from parent to child.
-    if (uvmcopy(p->pagetable, np->pagetable, p->sz) < 0) {
+    if (uvmcopy(vm->pagetable, np->pagetable, vm->sz) < 0) {
         freeproc(np);
         release(&np->lock);
+        vmunlock(vm);
         return -1;
     }
-    np->sz = p->sz;
+    np->sz = vm->sz;
     // ignore init & shell proc
-    if (p->pid > 2) {
-        release(&np->lock);
-        copy_swap_file(p, np);
-        acquire(&np->lock);
+    if (vm->pid > 2) {
         np->page_fault_counter = 0;
-        np->page_order_counter = p->page_order_counter;
-        np->pages_in_file_counter = p->pages_in_file_counter;
-        np->pages_in_memory_counter = p->pages_in_memory_counter;
+        memset(&np->pgstat, 0, sizeof(np->pgstat));
+        np->page_order_counter = vm->page_order_counter;
+        np->pages_in_file_counter = vm->pages_in_file_counter;
+        np->pages_in_memory_counter = vm->pages_in_memory_counter;
         // copy memory meta data
         for (int i = 0; i < MAX_PYSC_PAGES; i++) {
-            np->memory_pages[i] = p->memory_pages[i]; // copy memory_pages list
+            np->memory_pages[i] = vm->memory_pages[i]; // copy memory_pages list
         }
         // copy file pages meta data
         for (int i = 0; i < MAX_TOTAL_PAGES - MAX_PYSC_PAGES; i++) {
-            np->file_pages[i] = p->file_pages[i]; //  copies file_pages list
+            np->file_pages[i] = vm->file_pages[i]; //  copies file_pages list
         }
+        // share the swapped-out pages' slots with the child
+        release(&np->lock);
+        copy_swap_file(vm, np);
+        acquire(&np->lock);
     }
+    vmunlock(vm);
     // copy saved user registers.
     *(np->trapframe) = *(p->trapframe);
 
@@ -324,7 +432,7 @@ fork(void) {
     release(&wait_lock);
 
     acquire(&np->lock);
-    np->state = RUNNABLE;
+    setrunnable(np);
     release(&np->lock);
 
     return pid;
@@ -361,9 +469,15 @@ exit(int status) {
             p->ofile[fd] = 0;
         }
     }
-    if (p->pid > 2 && !is_none_policy()){
-        removeSwapFile(p);
-        clear_memory_metadata();
+    if (p->leader != p) {
+        thread_exit(p);
+    } else {
+        // the threads go first, they use our address space.
+        thread_killall(p);
+        if (p->pid > 2 && !is_none_policy()){
+            removeSwapFile(p);
+            clear_memory_metadata();
+        }
     }
 
     begin_op();
@@ -402,6 +516,7 @@ wait(uint64 addr) {
     acquire(&wait_lock);
 
     for (;;) {
+        again:
         // Scan through table looking for exited children.
         havekids = 0;
         for (np = proc; np < &proc[NPROC]; np++) {
@@ -417,7 +532,12 @@ wait(uint64 addr) {
                                              sizeof(np->xstate)) < 0) {
                         release(&np->lock);
                         release(&wait_lock);
-                        return -1;
+                        // copyout() can't page addr in under our
+                        // locks; do it, and look again.
+                        if (uvmpagein(addr, sizeof(np->xstate)) < 0)
+                            return -1;
+                        acquire(&wait_lock);
+                        goto again;
                     }
                     freeproc(np);
                     release(&np->lock);
@@ -439,10 +559,376 @@ wait(uint64 addr) {
     }
 }
 
+// Threads. clone() makes a process that runs in the address
+// space of the caller's leader, with a trapframe of its own
+// mapped at THREADFRAME(slot). A thread is otherwise an
+// ordinary process: it has its own pid and kernel stack, is
+// scheduled on its own, and is reaped by wait(). It leaves the
+// address space in exit(); a leader that exits kills its
+// threads and waits for them first. Lock order: vmlock(), then
+// the locks paging takes; vmlk, then the locks of wakeup().
+
+// Lock p's address space against the other threads in it,
+// for paging and for changing its size. Paging waits for the
+// disk, so this is a sleeping lock, like acquiresleep().
+void
+vmlock(struct proc *p) {
+    acquire(&p->vmlk);
+    while (p->vmlocked)
+        sleep(&p->vmlocked, &p->vmlk);
+    p->vmlocked = 1;
+    release(&p->vmlk);
+}
+
+void
+vmunlock(struct proc *p) {
+    acquire(&p->vmlk);
+    p->vmlocked = 0;
+    wakeup(&p->vmlocked);
+    release(&p->vmlk);
+}
+
+// Create a thread in the current address space that starts
+// at fn(arg), with its stack pointer at stack. It gets copies
+// of the caller's open files, and is the caller's child. fn
+// must not return; the thread ends with exit().
+// Returns the thread's pid, or -1.
+int
+clone(uint64 fn, uint64 arg, uint64 stack) {
+    int i, pid, slot;
+    struct proc *np;
+    struct proc *p = myproc();
+    struct proc *vm = p->leader;
+
+    vmlock(vm);
+    for (slot = 1; slot < NTHREAD && (vm->tfslots & (1 << slot)); slot++)
+        ;
+    if (slot == NTHREAD || (np = allocproc(vm)) == 0) {
+        vmunlock(vm);
+        return -1;
+    }
+    if (mappages(vm->pagetable, THREADFRAME(slot), PGSIZE,
+                 (uint64) (np->trapframe), PTE_R | PTE_W) < 0) {
+        freeproc(np);
+        release(&np->lock);
+        vmunlock(vm);
+        return -1;
+    }
+    np->tfslot = slot;
+    vm->tfslots |= 1 << slot;
+
+    // a return from fn faults.
+    *(np->trapframe) = *(p->trapframe);
+    np->trapframe->epc = fn;
+    np->trapframe->a0 = arg;
+    np->trapframe->sp = stack & ~0xfL;
+    np->trapframe->ra = -1;
+
+    for (i = 0; i < NOFILE; i++)
+        if (p->ofile[i])
+            np->ofile[i] = filedup(p->ofile[i]);
+    np->cwd = idup(p->cwd);
+
+    safestrcpy(np->name, p->name, sizeof(p->name));
+
+    pid = np->pid;
+    release(&np->lock);
+
+    acquire(&vm->vmlk);
+    vm->nthreads++;
+    release(&vm->vmlk);
+    vmunlock(vm);
+
+    acquire(&wait_lock);
+    np->parent = p;
+    release(&wait_lock);
+
+    acquire(&np->lock);
+    setrunnable(np);
+    release(&np->lock);
+
+    return pid;
+}
+
+// Called by exiting thread p: leave the leader's address
+// space, and wake the leader if it waits for us to.
+static void
+thread_exit(struct proc *p) {
+    struct proc *vm = p->leader;
+
+    vmlock(vm);
+    uvmunmap(vm->pagetable, THREADFRAME(p->tfslot), 1, 0);
+    vm->tfslots &= ~(1 << p->tfslot);
+    vmunlock(vm);
+    p->pagetable = 0;
+    p->leader = p;
+
+    acquire(&vm->vmlk);
+    vm->nthreads--;
+    wakeup(&vm->nthreads);
+    release(&vm->vmlk);
+}
+
+// Called by exiting leader p: kill its threads and wait until
+// they have all left. A thread cloned meanwhile is killed on
+// the next pass.
+static void
+thread_killall(struct proc *p) {
+    struct proc *q;
+
+    acquire(&p->vmlk);
+    while (p->nthreads > 1) {
+        release(&p->vmlk);
+        for (q = proc; q < &proc[NPROC]; q++) {
+            if (q == p)
+                continue;
+            acquire(&q->lock);
+            if (q->leader == p) {
+                q->killed = 1;
+                if (q->state == SLEEPING)
+                    setrunnable(q);
+            }
+            release(&q->lock);
+        }
+        acquire(&p->vmlk);
+        if (p->nthreads > 1)
+            sleep(&p->nthreads, &p->vmlk);
+    }
+    release(&p->vmlk);
+}
+
+// Called after tlb_flush() invalidated translations of the
+// address space of leader p that other threads of it may be
+// using: make the harts running those threads take them out of
+// their TLBs too, which they do for the IPI in devintr(), and
+// wait until they have. The caller must hold no spinlocks.
+void
+tlb_shootdown(struct proc *p) {
+    struct proc *me = myproc();
+    struct proc *q;
+    int intena = intr_get();
+    uint harts, kicked = 0;
+
+    intr_on();
+    for (;;) {
+        // recomputed each time: a hart that has moved on to
+        // another process no longer matters.
+        harts = 0;
+        for (q = proc; q < &proc[NPROC]; q++) {
+            if (q != me && q->leader == p && q->state == RUNNING)
+                harts |= 1 << q->cpu;
+        }
+        if ((harts &= p->tlb_stale) == 0)
+            break;
+        for (int i = 0; i < NCPU; i++) {
+            if ((harts & ~kicked) & (1 << i))
+                timer_kick(i);
+        }
+        kicked |= harts;
+    }
+    if (!intena)
+        intr_off();
+}
+
+// Each CPU has a run queue with NMLFQ priority levels.
+// A process starts at level 0 and moves down a level each
+// time it uses up its time slice, which is sched_quantum
+// cycles at level 0 and doubles per level, so CPU hogs sink
+// while processes that sleep before their slice is up keep
+// their level. Every MLFQ_BOOST ticks all processes go back
+// to level 0, so the low levels don't starve.
+//
+// A RUNNABLE process that isn't running is on exactly one
+// run queue, cpus[p->cpu].rq. p->cpu is where the process
+// last ran, so it keeps going back to the hart whose TLB and
+// cache it warmed; only a hart with nothing else to run takes
+// it away, by stealing from the busiest queue. Lock order:
+// p->lock, then a run queue's lock.
+
+// Index of the online CPU with the fewest queued processes,
+// where a new process goes. The counts are read without the
+// run queue locks; a stale value only costs balance.
+int
+runq_least_loaded(void) {
+    int best = cpuid();
+
+    for (int i = 0; i < NCPU; i++) {
+        if (cpus[i].rq.online && (!cpus[best].rq.online || cpus[i].rq.n < cpus[best].rq.n))
+            best = i;
+    }
+    return best;
+}
+
+// Wake an idle hart other than cpus[busy], which has more
+// queued than it can run now, to steal from it.
+static void
+runq_kick_idle(int busy) {
+    for (int i = 0; i < NCPU; i++) {
+        if (i != busy && cpus[i].rq.online && cpus[i].rq.idle) {
+            timer_kick(i);
+            return;
+        }
+    }
+}
+
+// Queue p at the tail of its level on cpus[p->cpu]. If that
+// hart is idle, wake it; if p has to wait there while another
+// hart idles, wake that one to steal it.
+// Caller must hold p->lock, and p must be RUNNABLE.
+static void
+runq_push(struct proc *p) {
+    struct cpu *c = &cpus[p->cpu];
+    struct runq *rq = &c->rq;
+    uint epoch = ticks / MLFQ_BOOST;
+    int n;
+
+    if (p->epoch != epoch) {
+        p->epoch = epoch;
+        p->level = 0;
+        p->slice = 0;
+    }
+    p->rq_next = 0;
+    acquire(&rq->lock);
+    if (rq->tail[p->level])
+        rq->tail[p->level]->rq_next = p;
+    else
+        rq->head[p->level] = p;
+    rq->tail[p->level] = p;
+    n = ++rq->n;
+    release(&rq->lock);
+    if (rq->idle) {
+        if (p->cpu != cpuid())
+            timer_kick(p->cpu);
+    } else if (n > 1 || c->proc != 0) {
+        runq_kick_idle(p->cpu);
+    }
+}
+
+// Unlink and return the first process of the highest non-empty
+// level of rq, or 0. Caller must hold rq->lock.
+static struct proc *
+runq_take(struct runq *rq) {
+    struct proc *p;
+
+    for (int l = 0; l < NMLFQ; l++) {
+        if ((p = rq->head[l]) != 0) {
+            if ((rq->head[l] = p->rq_next) == 0)
+                rq->tail[l] = 0;
+            p->rq_next = 0;
+            rq->n--;
+            return p;
+        }
+    }
+    return 0;
+}
+
+// Take the first process of the highest non-empty level off
+// c's run queue, or return 0 if it is empty. When a boost
+// period has begun, first move every level onto level 0;
+// the processes' own levels are reset as they are run.
+static struct proc *
+runq_pop(struct cpu *c) {
+    struct runq *rq = &c->rq;
+    struct proc *p = 0;
+    uint epoch = ticks / MLFQ_BOOST;
+    int l;
+
+    acquire(&rq->lock);
+    if (rq->epoch != epoch) {
+        rq->epoch = epoch;
+        for (l = 1; l < NMLFQ; l++) {
+            if (rq->head[l] == 0)
+                continue;
+            if (rq->tail[0])
+                rq->tail[0]->rq_next = rq->head[l];
+            else
+                rq->head[0] = rq->head[l];
+            rq->tail[0] = rq->tail[l];
+            rq->head[l] = rq->tail[l] = 0;
+        }
+    }
+    p = runq_take(rq);
+    release(&rq->lock);
+    return p;
+}
+
+// Called by an idle c: take the next process to run off the
+// online hart with the most queued processes, or return 0 if
+// every queue is empty.
+static struct proc *
+runq_steal(struct cpu *c) {
+    struct cpu *busiest = 0;
+    struct proc *p;
+
+    for (struct cpu *v = cpus; v < &cpus[NCPU]; v++) {
+        if (v != c && v->rq.online && v->rq.n > 0 && (busiest == 0 || v->rq.n > busiest->rq.n))
+            busiest = v;
+    }
+    if (busiest == 0)
+        return 0;
+    acquire(&busiest->rq.lock);
+    p = runq_take(&busiest->rq);
+    release(&busiest->rq.lock);
+    return p;
+}
+
+// Is a process queued on an online hart other than c?
+// Read without the locks, like runq_least_loaded().
+static int
+runq_stealable(struct cpu *c) {
+    for (struct cpu *v = cpus; v < &cpus[NCPU]; v++) {
+        if (v != c && v->rq.online && v->rq.n > 0)
+            return 1;
+    }
+    return 0;
+}
+
+// Is a process of a higher level than level waiting on c?
+// Read without the lock, like runq_least_loaded().
+static int
+runq_higher(struct cpu *c, int level) {
+    for (int l = 0; l < level; l++) {
+        if (c->rq.head[l])
+            return 1;
+    }
+    return 0;
+}
+
+// Cycles left of p's time slice.
+static uint64
+slice_left(struct proc *p) {
+    uint64 limit = sched_quantum << p->level;
+    return p->slice < limit ? limit - p->slice : 1;
+}
+
+// Charge the time since p last ran or was charged to its
+// user or system time, and to its time slice. Called by
+// p itself, or by the scheduler holding p->lock.
+void
+runtime_charge(struct proc *p, int user) {
+    uint64 now = r_time();
+
+    if (user)
+        p->utime += now - p->stamp;
+    else
+        p->stime += now - p->stamp;
+    p->slice += now - p->stamp;
+    p->stamp = now;
+}
+
+// Make p RUNNABLE, on its CPU's run queue, with a fresh time
+// slice. Caller must hold p->lock.
+static void
+setrunnable(struct proc *p) {
+    p->state = RUNNABLE;
+    p->slice = 0;
+    runq_push(p);
+}
+
 // Per-CPU process scheduler.
 // Each CPU calls scheduler() after setting itself up.
 // Scheduler never returns.  It loops, doing:
-//  - choose a process to run.
+//  - take a process off this CPU's run queue.
 //  - swtch to start running that process.
 //  - eventually that process transfers control
 //    via swtch back to the scheduler.
@@ -451,34 +937,53 @@ scheduler(void) {
     struct proc *p;
     struct cpu *c = mycpu();
     c->proc = 0;
+    c->rq.online = 1;
     for (;;) {
         // Avoid deadlock by ensuring that devices can interrupt.
         intr_on();
-        int found = 0;
-        for (p = proc; p < &proc[NPROC]; p++) {
-            acquire(&p->lock);
-            if (p->state == RUNNABLE) {
-                // Switch to chosen process.  It is the process's job
-                // to release its lock and then reacquire it
-                // before jumping back to us.
-                p->state = RUNNING;
-                c->proc = p;
-                swtch(&c->context, &p->context);
-                // Process is done running for now.
-                // It should have changed its p->state before coming back.
-                // Update access counter after process finished running.
-                #if defined(NFUA) || defined(LAPA)
-                update_access_counter(p);
-                #endif
-                c->proc = 0;
-                found = 1;
+        if ((p = runq_pop(c)) == 0 && (p = runq_steal(c)) == 0) {
+            // nothing to do: stop the tick and wait for an
+            // interrupt. runq_push() sends an IPI once it sees
+            // idle, for work queued here or waiting on a busy
+            // hart, so work queued after our check still wakes
+            // us. Interrupts stay off from the check to wfi,
+            // so that such an IPI stays pending and ends it.
+            intr_off();
+            c->rq.idle = 1;
+            __sync_synchronize();
+            if (c->rq.n == 0 && !runq_stealable(c)) {
+                timer_rearm(0);
+                asm volatile("wfi");
             }
-            release(&p->lock);
+            c->rq.idle = 0;
+            continue;
         }
-        if(found == 0) {
-            intr_on();
-            asm volatile("wfi");
+        // p is off every queue, so only we change its
+        // level and slice until it runs.
+        if (p->epoch != c->rq.epoch) {
+            p->epoch = c->rq.epoch;
+            p->level = 0;
+            p->slice = 0;
         }
+        timer_rearm(slice_left(p));
+        acquire(&p->lock);
+        if (p->state != RUNNABLE)
+            panic("scheduler: not runnable");
+        // Switch to chosen process.  It is the process's job
+        // to release its lock and then reacquire it
+        // before jumping back to us.
+        p->state = RUNNING;
+        p->cpu = c - cpus; // stolen processes stay with us
+        p->stamp = r_time();
+        c->proc = p;
+        swtch(&c->context, &p->context);
+        // Process is done running for now.
+        // It should have changed its p->state before coming back.
+        c->proc = 0;
+        // preempted or yielded: back on the queue
+        if (p->state == RUNNABLE)
+            runq_push(p);
+        release(&p->lock);
     }
 }
 
@@ -502,6 +1007,11 @@ sched(void) {
     if (intr_get())
         panic("sched interruptible");
 
+    runtime_charge(p, 0);
+    if (p->state == SLEEPING)
+        p->nvcsw++;
+    else if (p->state == RUNNABLE)
+        p->nivcsw++;
     intena = mycpu()->intena;
     swtch(&p->context, &mycpu()->context);
     mycpu()->intena = intena;
@@ -517,6 +1027,31 @@ yield(void) {
     release(&p->lock);
 }
 
+// Called on the running process's clock tick. Give up the
+// CPU, one level lower, once its time slice is used up, or
+// earlier if a process of a higher level is waiting.
+void
+sched_tick(void) {
+    struct proc *p = myproc();
+    uint64 left;
+
+    acquire(&p->lock);
+    runtime_charge(p, 0);
+    if (p->slice >= sched_quantum << p->level) {
+        if (p->level < NMLFQ - 1)
+            p->level++;
+        p->slice = 0;
+    } else if (!runq_higher(mycpu(), p->level)) {
+        left = slice_left(p);
+        release(&p->lock);
+        timer_rearm(left);
+        return;
+    }
+    p->state = RUNNABLE;
+    sched();
+    release(&p->lock);
+}
+
 // A fork child's very first scheduling by scheduler()
 // will swtch to forkret.
 void
@@ -537,33 +1072,82 @@ forkret(void) {
     usertrapret();
 }
 
+// Sleeping processes are linked into one of NWAITQ wait
+// queues, chosen by hashing the channel, so wakeup(chan)
+// only looks at processes sleeping on chan or a channel
+// hashing like it. A process is taken off its queue by the
+// wakeup() that wakes it, or by itself when kill() woke it.
+// Lock order: the lock passed to sleep(), a wait queue's
+// lock, p->lock.
+struct waitq {
+    struct spinlock lock;
+    struct proc *head;
+};
+
+static struct waitq waitq[NWAITQ];
+
+#define WAITQ_HASH(chan) ((((uint64) (chan)) >> 3) % NWAITQ)
+
+static void
+waitqinit(void) {
+    for (int i = 0; i < NWAITQ; i++)
+        initticketlock(&waitq[i].lock, "waitq");
+}
+
+// Take p off its wait queue, if it is still on one.
+// Only p itself puts it on a queue, so p->wq can only
+// change to 0 under us.
+static void
+waitq_remove(struct proc *p) {
+    struct waitq *wq = p->wq;
+    struct proc **pp;
+
+    if (wq == 0)
+        return;
+    acquire(&wq->lock);
+    if (p->wq == wq) {
+        for (pp = &wq->head; *pp != p; pp = &(*pp)->wq_next)
+            ;
+        *pp = p->wq_next;
+        p->wq = 0;
+    }
+    release(&wq->lock);
+}
+
 // Atomically release lock and sleep on chan.
 // Reacquires lock when awakened.
 void
 sleep(void *chan, struct spinlock *lk) {
     struct proc *p = myproc();
+    struct waitq *wq = &waitq[WAITQ_HASH(chan)];
 
     // Must acquire p->lock in order to
     // change p->state and then call sched.
-    // Once we hold p->lock, we can be
+    // Once we hold wq->lock, we can be
     // guaranteed that we won't miss any wakeup
-    // (wakeup locks p->lock),
+    // (wakeup locks wq->lock),
     // so it's okay to release lk.
 
-    acquire(&p->lock);  //DOC: sleeplock1
+    acquire(&wq->lock);  //DOC: sleeplock1
+    acquire(&p->lock);
     release(lk);
 
     // Go to sleep.
     p->chan = chan;
+    p->wq = wq;
+    p->wq_next = wq->head;
+    wq->head = p;
     p->state = SLEEPING;
+    release(&wq->lock);
 
     sched();
 
     // Tidy up.
     p->chan = 0;
+    release(&p->lock);
+    waitq_remove(p);
 
     // Reacquire original lock.
-    release(&p->lock);
     acquire(lk);
 }
 
@@ -571,17 +1155,25 @@ sleep(void *chan, struct spinlock *lk) {
 // Must be called without any p->lock.
 void
 wakeup(void *chan) {
-    struct proc *p;
+    struct waitq *wq = &waitq[WAITQ_HASH(chan)];
+    struct proc *p, **pp;
 
-    for (p = proc; p < &proc[NPROC]; p++) {
+    acquire(&wq->lock);
+    for (pp = &wq->head; (p = *pp) != 0;) {
         if (p != myproc()) {
             acquire(&p->lock);
             if (p->state == SLEEPING && p->chan == chan) {
-                p->state = RUNNABLE;
+                *pp = p->wq_next;
+                p->wq = 0;
+                setrunnable(p);
+                release(&p->lock);
+                continue;
             }
             release(&p->lock);
         }
+        pp = &p->wq_next;
     }
+    release(&wq->lock);
 }
 
 // Kill the process with the given pid.
@@ -591,13 +1183,15 @@ int
 kill(int pid) {
 
     struct proc *p;
+    if (pid <= 0)   // unused slots and kernel processes
+        return -1;
     for (p = proc; p < &proc[NPROC]; p++) {
         acquire(&p->lock);
         if (p->pid == pid) {
             p->killed = 1;
             if (p->state == SLEEPING) {
                 // Wake process from sleep().
-                p->state = RUNNABLE;
+                setrunnable(p);
             }
             release(&p->lock);
             return 0;
@@ -607,6 +1201,81 @@ kill(int pid) {
     return -1;
 }
 
+// Copy the run time statistics of process pid to user address addr.
+int
+getrusage(int pid, uint64 addr) {
+    struct proc *p;
+    struct rusage ru;
+
+    for (p = proc; p < &proc[NPROC]; p++) {
+        acquire(&p->lock);
+        if (p->pid == pid && p->state != UNUSED) {
+            ru.utime = p->utime;
+            ru.stime = p->stime;
+            ru.faulttime = p->ftime;
+            ru.nvcsw = p->nvcsw;
+            ru.nivcsw = p->nivcsw;
+            ru.level = p->level;
+            release(&p->lock);
+            return copyout(myproc()->pagetable, addr, (char *) &ru, sizeof(ru));
+        }
+        release(&p->lock);
+    }
+    return -1;
+}
+
+// Set the level 0 time slice to usec microseconds, if usec
+// is positive. Returns the previous length, or -1 if usec is
+// below MLFQ_QUANTUM_MIN: every hart would spend its time in
+// timer interrupts.
+int
+quantum(int usec) {
+    int old = sched_quantum / (TIMER_HZ / 1000000);
+
+    if (usec > 0 && usec < MLFQ_QUANTUM_MIN)
+        return -1;
+    if (usec > 0)
+        sched_quantum = (uint64) usec * (TIMER_HZ / 1000000);
+    return old;
+}
+
+// Copy the paging statistics of process pid to user address addr.
+int
+pagestat(int pid, uint64 addr) {
+    struct proc *p, *vm;
+    struct pagestat st;
+
+    for (p = proc; p < &proc[NPROC]; p++) {
+        acquire(&p->lock);
+        if (p->pid == pid && p->state != UNUSED) {
+            // a thread reports its address space's paging.
+            vm = p->leader;
+            memset(&st, 0, sizeof(st));
+            st.policy = paging_policy();
+            st.resident = vm->pages_in_memory_counter;
+            st.swapped = vm->pages_in_file_counter;
+            st.faults = vm->page_fault_counter;
+            st.tlbfaults = vm->pgstat.tlb_faults;
+            st.pageins = vm->pgstat.page_ins;
+            st.pageouts = vm->pgstat.page_outs;
+            st.cleanouts = vm->pgstat.clean_outs;
+            st.readbytes = vm->pgstat.read_bytes;
+            st.writebytes = vm->pgstat.write_bytes;
+            st.ioticks = vm->pgstat.io_ticks;
+            st.scans = vm->pgstat.scans;
+            st.scanned = vm->pgstat.scanned;
+            if (vm->swap) {
+                st.swapslots = swap_slots_top(vm->swap);
+                st.swapholes = swap_fragmentation(vm->swap);
+            }
+            release(&p->lock);
+            return copyout(myproc()->pagetable, addr, (char *) &st, sizeof(st));
+        }
+        release(&p->lock);
+    }
+    return -1;
+}
+
 // Copy to either a user address, or kernel address,
 // depending on usr_dst.
 // Returns 0 on success, -1 on error.
@@ -665,10 +1334,12 @@ procdump(void) {
 
 void clear_memory_metadata(){
     struct proc *p = myproc();
+    swap_release_pages(p);
     p->page_order_counter = 0;
     p->pages_in_file_counter = 0;
     p->pages_in_memory_counter = 0;
     p->page_fault_counter = 0;
+    memset(&p->pgstat, 0, sizeof(p->pgstat));
 
     for (int i = 0; i < MAX_PYSC_PAGES; i++) {
         p->memory_pages[i].state = P_UNUSED;
@@ -18,12 +18,38 @@ struct context {
     uint64 s11;
 };
 
+// A CPU's multi-level feedback run queue: one FIFO of
+// RUNNABLE processes per priority level, level 0 first.
+struct runq {
+    struct spinlock lock;
+    struct proc *head[NMLFQ];
+    struct proc *tail[NMLFQ];
+    int n;                      // Queued processes
+    uint epoch;                 // Boost period the levels belong to
+    int online;                 // This CPU has entered scheduler()
+    int idle;                   // Waiting in wfi; needs an IPI for new work
+};
+
+// A CPU's timers: the timed sleeps it will end, on a wheel
+// with a slot per tick modulo NTIMERWHEEL, each slot sorted
+// by deadline. See timer.c.
+struct timerq {
+    struct spinlock lock;
+    struct proc *wheel[NTIMERWHEEL];
+    uint64 done;                // Ticks before this have been expired
+    uint64 tick;                // When the next scheduling tick is due
+    uint64 armed;               // What the CLINT timer is set for
+};
+
 // Per-CPU state.
 struct cpu {
     struct proc *proc;          // The process running on this cpu, or null.
     struct context context;     // swtch() here to enter scheduler().
     int noff;                   // Depth of push_off() nesting.
     int intena;                 // Were interrupts enabled before push_off()?
+    int asids;                  // Has an ASID for each proc, see kvminithart()
+    struct runq rq;             // Processes waiting to run here
+    struct timerq tq;           // Timed sleeps ending here
 };
 
 extern struct cpu cpus[NCPU];
@@ -88,12 +114,37 @@ enum page_metadata_state {
     P_UNUSED, P_USED
 };
 
+// a process's swap file, shared with its children's
+// pages through reference-counted slots; see fs.c.
+struct swapfile {
+    struct file *f;     // the open /.swapN file
+    int ref;            // owner + one per slot reference
+    uint bitmap;        // slots in use
+    int backed;         // slots the file covers on disk
+    uchar slotref[SWAP_FILE_SLOTS]; // pages referring to each slot
+};
+
 // pages struct
 struct page_metadata_struct{
     enum page_metadata_state state;
     uint64 user_page_VA;
     uint page_order;
     uint access_count;
+    struct swapfile *swap;       // swap file holding the page's slot, if any
+    int slot;                    // the slot within swap
+};
+
+// paging counters of a process, reported by pagestat()
+struct pagingstat {
+    uint tlb_faults;             // faults retried on a stale TLB entry
+    uint page_ins;               // pages read back from swap
+    uint page_outs;              // pages evicted to swap
+    uint clean_outs;             // evictions that needed no write
+    uint64 read_bytes;           // bytes read from swap
+    uint64 write_bytes;          // bytes written to swap
+    uint io_ticks;               // ticks spent waiting on swap I/O
+    uint scans;                  // paging policy passes for a victim
+    uint scanned;                // pages the policy examined doing so
 };
 
 // Per-process state
@@ -106,22 +157,60 @@ struct proc {
     int killed;                  // If non-zero, have been killed
     int xstate;                  // Exit status to be returned to parent's wait
     int pid;                     // Process ID
+    int cpu;                     // CPU whose run queue we go on
+    int level;                   // MLFQ priority level, 0 is highest
+    uint64 slice;                // Timer cycles used of this level's time slice
+    uint epoch;                  // Boost period level belongs to
+    struct proc *rq_next;        // Next in run queue, under its lock
+    struct waitq *wq;            // Wait queue we sleep on, under its lock
+    struct proc *wq_next;        // Next on that wait queue
+    uint64 deadline;             // Time a timed sleep ends
+    struct timerq *tq;           // Timer wheel we're on, under its lock
+    struct proc *tq_next;        // Next in timer wheel slot
+    uint64 fx_addr;              // User address of the futex we sleep on
+    struct futexq *fx_q;         // Its futex queue, under that queue's lock
+    struct proc *fx_next;        // Next on that futex queue
 
     // proc_tree_lock must be held when using this:
     struct proc *parent;         // Parent process
 
+    // Threads made by clone() share the address space of their
+    // leader: its page table, size, swap file, page metadata,
+    // paging counters and ASID below are the ones in use, and
+    // a thread's own copies of them are unused.
+    struct proc *leader;         // Owner of our address space; us unless a thread
+    int tfslot;                  // Our trapframe is mapped at THREADFRAME(tfslot)
+    struct spinlock vmlk;        // Protects vmlocked, nthreads, npinned, agetime
+    int vmlocked;                // Address space locked, see vmlock()
+    int nthreads;                // Threads in the address space, leader included
+    int npinned;                 // Copies using its frames, see copy_pin()
+    uint64 agetime;              // Threads' run time since the last aging sweep
+    uint tfslots;                // THREADFRAME slots in use, under vmlock()
+
     // these are private to the process, so p->lock need not be held.
     uint64 kstack;               // Virtual address of kernel stack
+    void (*kfn)(void);           // What a kernel process runs; see kproc()
     uint64 sz;                   // Size of process memory (bytes)
     pagetable_t pagetable;       // User page table
+    int asid;                    // Address-space id tagging pagetable's TLB entries
+    uint tlb_stale;              // Harts that must flush asid before running us
     struct trapframe *trapframe; // data page for trampoline.S
     struct context context;      // swtch() here to run process
     struct file *ofile[NOFILE];  // Open files
     struct inode *cwd;           // Current directory
     char name[16];               // Process name (debugging)
     int page_fault_counter;
+    uint64 stamp;                // Time runtime was last charged
+    uint64 utime;                // Timer cycles run in user mode
+    uint64 stime;                // Timer cycles run in the kernel
+    uint64 ftime;                // Timer cycles spent in page faults
+    uint nvcsw;                  // Voluntary context switches
+    uint nivcsw;                 // Involuntary context switches
+    struct pagingstat pgstat;    // more paging counters
+    uint64 aged;                 // Run time added to our leader's agetime
+    int nofault;                 // User copies must not page in, see copy_pin()
 
-    struct file *swapFile;
+    struct swapfile *swap;       // our own swap file
     struct page_metadata_struct file_pages[MAX_TOTAL_PAGES - MAX_PYSC_PAGES];
     struct page_metadata_struct memory_pages[MAX_PYSC_PAGES];
     uint64 page_order_counter; // count on load or creation
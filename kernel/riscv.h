@@ -187,6 +187,14 @@ w_mtvec(uint64 x)
 
 #define MAKE_SATP(pagetable) (SATP_SV39 | (((uint64)pagetable) >> 12))
 
+// satp with an address-space identifier, so TLB entries of
+// different page tables can live side by side.
+// ASID 0 is the kernel's.
+#define SATP_ASID_SHIFT 44
+#define SATP_ASID_MAX 0xFFFFL
+#define MAKE_SATP_ASID(pagetable, asid) \
+  (MAKE_SATP(pagetable) | (((uint64)(asid)) << SATP_ASID_SHIFT))
+
 // supervisor address translation and protection;
 // holds the address of the page table.
 static inline void 
@@ -249,7 +257,8 @@ r_mcounteren()
   return x;
 }
 
-// machine-mode cycle counter
+// machine-mode cycle counter; supervisor mode
+// can read it once start() sets mcounteren.TM.
 static inline uint64
 r_time()
 {
@@ -320,6 +329,20 @@ sfence_vma()
   asm volatile("sfence.vma zero, zero");
 }
 
+// flush the TLB entries of one virtual page in one address space.
+static inline void
+sfence_vma_page(uint64 va, uint64 asid)
+{
+  asm volatile("sfence.vma %0, %1" : : "r" (va), "r" (asid));
+}
+
+// flush all (non-global) TLB entries of one address space.
+static inline void
+sfence_vma_asid(uint64 asid)
+{
+  asm volatile("sfence.vma zero, %0" : : "r" (asid));
+}
+
 
 #define PGSIZE 4096 // bytes per page
 #define PGSHIFT 12  // bits of offset within a page
@@ -333,6 +356,7 @@ sfence_vma()
 #define PTE_X (1L << 3)
 #define PTE_U (1L << 4) // 1 -> user can access
 #define PTE_A (1L << 6) // Accessed
+#define PTE_D (1L << 7) // Dirty
 
 
 // shift a physical address to the right place for a PTE.
@@ -0,0 +1,8 @@
+struct rusage {
+  uint64 utime;        // Timer cycles running in user mode
+  uint64 stime;        // Timer cycles running in the kernel
+  uint64 faulttime;    // Timer cycles handling page faults
+  uint nvcsw;          // Voluntary context switches (sleeps)
+  uint nivcsw;         // Involuntary ones (preemptions)
+  int level;           // MLFQ priority level, 0 is highest
+};
@@ -16,17 +16,28 @@ initsleeplock(struct sleeplock *lk, char *name)
   lk->name = name;
   lk->locked = 0;
   lk->pid = 0;
+#ifdef LOCKSTAT
+  lk->stat = lockstat_get(name, 1);
+#endif
 }
 
 void
 acquiresleep(struct sleeplock *lk)
 {
   acquire(&lk->lk);
+#ifdef LOCKSTAT
+  int contended = lk->locked;
+  uint64 t0 = r_time();
+#endif
   while (lk->locked) {
     sleep(lk, &lk->lk);
   }
   lk->locked = 1;
   lk->pid = myproc()->pid;
+#ifdef LOCKSTAT
+  lk->stamp = r_time();
+  lockstat_acquired(lk->stat, contended, lk->stamp - t0);
+#endif
   release(&lk->lk);
 }
 
@@ -34,6 +45,9 @@ void
 releasesleep(struct sleeplock *lk)
 {
   acquire(&lk->lk);
+#ifdef LOCKSTAT
+  lockstat_released(lk->stat, r_time() - lk->stamp);
+#endif
   lk->locked = 0;
   lk->pid = 0;
   wakeup(lk);
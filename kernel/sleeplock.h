@@ -6,5 +6,10 @@ struct sleeplock {
   // For debugging:
   char *name;        // Name of lock.
   int pid;           // Process holding lock
+
+#ifdef LOCKSTAT
+  struct lockstat *stat; // Statistics of the locks with this name.
+  uint64 stamp;      // When the lock was acquired.
+#endif
 };
 
@@ -7,6 +7,7 @@
 #include "riscv.h"
 #include "proc.h"
 #include "defs.h"
+#include "lockstat.h"
 
 void
 initlock(struct spinlock *lk, char *name)
@@ -14,23 +15,74 @@ initlock(struct spinlock *lk, char *name)
   lk->name = name;
   lk->locked = 0;
   lk->cpu = 0;
+  lk->fair = 0;
+  lk->next = 0;
+  lk->serving = 0;
+#ifdef LOCKSTAT
+  lk->stat = lockstat_get(name, 0);
+#endif
 }
 
-// Acquire the lock.
-// Loops (spins) until the lock is acquired.
+// Initialize a ticket lock, for a lock many harts compete for.
+// A plain spinlock goes to whichever hart's swap happens to
+// hit the free lock first, so under contention some harts can
+// wait a long time while others get it again and again. A
+// ticket lock is handed over in the order the harts asked.
 void
-acquire(struct spinlock *lk)
+initticketlock(struct spinlock *lk, char *name)
 {
-  push_off(); // disable interrupts to avoid deadlock.
-  if(holding(lk))
-    panic("acquire");
+  initlock(lk, name);
+  lk->fair = 1;
+}
 
+// Take lk by test-and-set. Returns 1 if it had to spin.
+static int
+tas_lock(struct spinlock *lk)
+{
   // On RISC-V, sync_lock_test_and_set turns into an atomic swap:
   //   a5 = 1
   //   s1 = &lk->locked
   //   amoswap.w.aq a5, a5, (s1)
+  if(__sync_lock_test_and_set(&lk->locked, 1) == 0)
+    return 0;
   while(__sync_lock_test_and_set(&lk->locked, 1) != 0)
     ;
+  return 1;
+}
+
+// Take a ticket (an amoadd) and spin, only reading, until it
+// is served. Returns 1 if it had to spin.
+static int
+ticket_lock(struct spinlock *lk)
+{
+  uint t = __sync_fetch_and_add(&lk->next, 1);
+  int spun = 0;
+
+  while(__atomic_load_n(&lk->serving, __ATOMIC_ACQUIRE) != t)
+    spun = 1;
+  lk->locked = 1;
+  return spun;
+}
+
+// Acquire the lock.
+// Loops (spins) until the lock is acquired.
+void
+acquire(struct spinlock *lk)
+{
+  push_off(); // disable interrupts to avoid deadlock.
+  if(holding(lk))
+    panic("acquire");
+
+#ifdef LOCKSTAT
+  uint64 t0 = r_time();
+  int contended = lk->fair ? ticket_lock(lk) : tas_lock(lk);
+  lockstat_acquired(lk->stat, contended, contended ? r_time() - t0 : 0);
+#else
+  if(lk->fair)
+    ticket_lock(lk);
+  else
+    tas_lock(lk);
+#endif
 
   // Tell the C compiler and the processor to not move loads or stores
   // past this point, to ensure that the critical section's memory
@@ -40,6 +92,9 @@ acquire(struct spinlock *lk)
 
   // Record info about lock acquisition for holding() and debugging.
   lk->cpu = mycpu();
+#ifdef LOCKSTAT
+  lk->stamp = r_time();
+#endif
 }
 
 // Release the lock.
@@ -49,6 +104,9 @@ release(struct spinlock *lk)
   if(!holding(lk))
     panic("release");
 
+#ifdef LOCKSTAT
+  lockstat_released(lk->stat, r_time() - lk->stamp);
+#endif
   lk->cpu = 0;
 
   // Tell the C compiler and the CPU to not move loads or stores
@@ -59,6 +117,15 @@ release(struct spinlock *lk)
   // On RISC-V, this emits a fence instruction.
   __sync_synchronize();
 
+  // A ticket lock goes to the next ticket.
+  if(lk->fair){
+    lk->locked = 0;
+    __sync_synchronize();
+    __sync_fetch_and_add(&lk->serving, 1);
+    pop_off();
+    return;
+  }
+
   // Release the lock, equivalent to lk->locked = 0.
   // This code doesn't use a C assignment, since the C standard
   // implies that an assignment might be implemented with
@@ -108,3 +175,158 @@ pop_off(void)
   if(c->noff == 0 && c->intena)
     intr_on();
 }
+
+// Lock statistics, built with LOCKSTAT. Locks are counted by
+// name, since most names stand for an array of locks or for
+// locks that come and go, like "proc" or "pipe". Each CPU
+// counts in its own cache line with interrupts off, so the
+// counting needs no atomics and adds no contention of its own.
+// Entries are only added, under lockstats_lock; once
+// NLOCKSTAT - 1 names are taken, the rest share the last.
+
+#ifdef LOCKSTAT
+struct lockcounts {
+  uint64 acquires;
+  uint64 contended;
+  uint64 waittime;
+  uint64 maxhold;
+} __attribute__((aligned(64)));
+
+struct lockstat {
+  char *name;
+  int sleep;
+  int nlocks;
+  struct lockcounts cpu[NCPU];
+};
+
+static struct lockstat lockstats[NLOCKSTAT];
+
+// not counted itself: it has no stat.
+static struct spinlock lockstats_lock = { .name = "lockstat" };
+
+// The statistics of sleep locks (if sleep) or spinlocks
+// named name.
+struct lockstat*
+lockstat_get(char *name, int sleep)
+{
+  struct lockstat *ls;
+
+  acquire(&lockstats_lock);
+  for(ls = lockstats; ls < &lockstats[NLOCKSTAT-1]; ls++){
+    if(ls->name == 0){
+      ls->name = name;
+      ls->sleep = sleep;
+      break;
+    }
+    if(ls->sleep == sleep && strncmp(ls->name, name, 16) == 0)
+      break;
+  }
+  if(ls->name == 0)
+    ls->name = "(other)";
+  ls->nlocks++;
+  release(&lockstats_lock);
+  return ls;
+}
+
+// Count an acquire of a lock of ls, which waited wait cycles
+// if contended. Interrupts must be off.
+void
+lockstat_acquired(struct lockstat *ls, int contended, uint64 wait)
+{
+  struct lockcounts *lc;
+
+  if(ls == 0)
+    return;
+  lc = &ls->cpu[cpuid()];
+  lc->acquires++;
+  if(contended){
+    lc->contended++;
+    lc->waittime += wait;
+  }
+}
+
+// Count the release of a lock of ls held for hold cycles.
+// Interrupts must be off.
+void
+lockstat_released(struct lockstat *ls, uint64 hold)
+{
+  struct lockcounts *lc;
+
+  if(ls == 0)
+    return;
+  lc = &ls->cpu[cpuid()];
+  if(hold > lc->maxhold)
+    lc->maxhold = hold;
+}
+#endif
+
+// Copy the statistics of up to n lock names to the struct
+// lockinfo array at user address addr, then clear them all if
+// reset. Returns the number of names copied, or -1 if the
+// kernel wasn't built with LOCKSTAT.
+int
+lockstat(uint64 addr, int n, int reset)
+{
+#ifdef LOCKSTAT
+  struct lockstat *ls;
+  struct lockinfo info;
+  int i, c;
+
+  for(i = 0, ls = lockstats; ls < &lockstats[NLOCKSTAT] && ls->name && i < n; ls++, i++){
+    memset(&info, 0, sizeof(info));
+    safestrcpy(info.name, ls->name, sizeof(info.name));
+    info.sleep = ls->sleep;
+    info.nlocks = ls->nlocks;
+    for(c = 0; c < NCPU; c++){
+      info.acquires += ls->cpu[c].acquires;
+      info.contended += ls->cpu[c].contended;
+      info.waittime += ls->cpu[c].waittime;
+      if(ls->cpu[c].maxhold > info.maxhold)
+        info.maxhold = ls->cpu[c].maxhold;
+    }
+    if(copyout(myproc()->pagetable, addr + i * sizeof(info), (char *)&info, sizeof(info)) < 0)
+      return -1;
+  }
+  if(reset){
+    for(ls = lockstats; ls < &lockstats[NLOCKSTAT]; ls++)
+      memset(ls->cpu, 0, sizeof(ls->cpu));
+  }
+  return i;
+#else
+  return -1;
+#endif
+}
+
+// A benchmark of lock fairness: acquire and release the shared
+// test-and-set (fair == 0) or ticket lock n times, and copy a
+// histogram of how long each acquire waited, NLOCKBENCH uints,
+// to user address addr. Run from several harts at once, its
+// tail shows how unevenly each kind of lock is handed out.
+static struct spinlock benchlock[2] = {
+  { .name = "bench" },
+  { .name = "bench ticket", .fair = 1 },
+};
+
+int
+lockbench(int fair, int n, uint64 addr)
+{
+  struct spinlock *lk = &benchlock[fair != 0];
+  uint hist[NLOCKBENCH];
+  uint64 t0, t;
+  int b;
+
+  memset(hist, 0, sizeof(hist));
+  for(int i = 0; i < n; i++){
+    t0 = r_time();
+    acquire(lk);
+    t = r_time() - t0;
+    // a short critical section
+    for(volatile int j = 0; j < 100; j++)
+      ;
+    release(lk);
+    for(b = 0; t && b < NLOCKBENCH - 1; b++)
+      t >>= 1;
+    hist[b]++;
+  }
+  return copyout(myproc()->pagetable, addr, (char *)hist, sizeof(hist));
+}
@@ -1,9 +1,17 @@
 // Mutual exclusion lock.
 struct spinlock {
   uint locked;       // Is the lock held?
+  int fair;          // A ticket lock? See initticketlock().
+  uint next;         // Ticket lock: next ticket to hand out
+  uint serving;      // Ticket lock: ticket allowed to hold the lock
 
   // For debugging:
   char *name;        // Name of lock.
   struct cpu *cpu;   // The cpu holding the lock.
+
+#ifdef LOCKSTAT
+  struct lockstat *stat; // Statistics of the locks with this name.
+  uint64 stamp;      // When the lock was acquired.
+#endif
 };
 
@@ -11,7 +11,7 @@
 int
 fetchaddr(uint64 addr, uint64 *ip)
 {
-  struct proc *p = myproc();
+  struct proc *p = myvm();
   if(addr >= p->sz || addr+sizeof(uint64) > p->sz)
     return -1;
   if(copyin(p->pagetable, (char *)ip, addr, sizeof(*ip)) != 0)
@@ -105,6 +105,15 @@ extern uint64 sys_wait(void);
 extern uint64 sys_write(void);
 extern uint64 sys_uptime(void);
 extern uint64 sys_page_fault_num(void);
+extern uint64 sys_pagestat(void);
+extern uint64 sys_nanosleep(void);
+extern uint64 sys_getrusage(void);
+extern uint64 sys_quantum(void);
+extern uint64 sys_clone(void);
+extern uint64 sys_futex(void);
+extern uint64 sys_lockstat(void);
+extern uint64 sys_lockbench(void);
+extern uint64 sys_bcachestat(void);
 
 static uint64 (*syscalls[])(void) = {
 [SYS_fork]    sys_fork,
@@ -129,6 +138,15 @@ static uint64 (*syscalls[])(void) = {
 [SYS_mkdir]   sys_mkdir,
 [SYS_close]   sys_close,
 [SYS_page_fault_num]   sys_page_fault_num,
+[SYS_pagestat] sys_pagestat,
+[SYS_nanosleep] sys_nanosleep,
+[SYS_getrusage] sys_getrusage,
+[SYS_quantum] sys_quantum,
+[SYS_clone]   sys_clone,
+[SYS_futex]   sys_futex,
+[SYS_lockstat] sys_lockstat,
+[SYS_lockbench] sys_lockbench,
+[SYS_bcachestat] sys_bcachestat,
 };
 
 void
@@ -21,3 +21,12 @@
 #define SYS_mkdir  20
 #define SYS_close  21
 #define SYS_page_fault_num  22
+#define SYS_pagestat 23
+#define SYS_nanosleep 24
+#define SYS_getrusage 25
+#define SYS_quantum 26
+#define SYS_clone 27
+#define SYS_futex 28
+#define SYS_lockstat 29
+#define SYS_lockbench 30
+#define SYS_bcachestat 31
@@ -218,6 +218,7 @@ sys_unlink(void)
   memset(&de, 0, sizeof(de));
   if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
     panic("unlink: writei");
+  dcache_unlink(dp, name);
   if(ip->type == T_DIR){
     dp->nlink--;
     iupdate(dp);
@@ -357,8 +358,12 @@ sys_mkdir(void)
   char path[MAXPATH];
   struct inode *ip;
 
+  // before begin_op(): argstr() may page in, which
+  // can't be done inside a transaction.
+  if(argstr(0, path, MAXPATH) < 0)
+    return -1;
   begin_op();
-  if(argstr(0, path, MAXPATH) < 0 || (ip = create(path, T_DIR, 0, 0)) == 0){
+  if((ip = create(path, T_DIR, 0, 0)) == 0){
     end_op();
     return -1;
   }
@@ -374,11 +379,12 @@ sys_mknod(void)
   char path[MAXPATH];
   int major, minor;
 
-  begin_op();
   if((argstr(0, path, MAXPATH)) < 0 ||
      argint(1, &major) < 0 ||
-     argint(2, &minor) < 0 ||
-     (ip = create(path, T_DEVICE, major, minor)) == 0){
+     argint(2, &minor) < 0)
+    return -1;
+  begin_op();
+  if((ip = create(path, T_DEVICE, major, minor)) == 0){
     end_op();
     return -1;
   }
@@ -394,8 +400,10 @@ sys_chdir(void)
   struct inode *ip;
   struct proc *p = myproc();
   
+  if(argstr(0, path, MAXPATH) < 0)
+    return -1;
   begin_op();
-  if(argstr(0, path, MAXPATH) < 0 || (ip = namei(path)) == 0){
+  if((ip = namei(path)) == 0){
     end_op();
     return -1;
   }
@@ -44,11 +44,15 @@ sys_sbrk(void)
   int addr;
   int n;
 
+  struct proc *vm = myvm();
+
   if(argint(0, &n) < 0)
     return -1;
-  addr = myproc()->sz;
+  vmlock(vm);
+  addr = vm->sz;
   if(growproc(n) < 0)
-    return -1;
+    addr = -1;
+  vmunlock(vm);
   return addr;
 }
 
@@ -56,21 +60,20 @@ uint64
 sys_sleep(void)
 {
   int n;
-  uint ticks0;
 
   if(argint(0, &n) < 0)
     return -1;
-  acquire(&tickslock);
-  ticks0 = ticks;
-  while(ticks - ticks0 < n){
-    if(myproc()->killed){
-      release(&tickslock);
-      return -1;
-    }
-    sleep(&ticks, &tickslock);
-  }
-  release(&tickslock);
-  return 0;
+  return sleep_until(r_time() + (uint64)n * TICK_INTERVAL);
+}
+
+uint64
+sys_nanosleep(void)
+{
+  uint64 ns;
+
+  if(argaddr(0, &ns) < 0)
+    return -1;
+  return sleep_until(r_time() + (ns * (TIMER_HZ / 1000000) + 999) / 1000);
 }
 
 uint64
@@ -90,6 +93,7 @@ sys_uptime(void)
 {
   uint xticks;
 
+  tickupdate();
   acquire(&tickslock);
   xticks = ticks;
   release(&tickslock);
@@ -99,5 +103,91 @@ sys_uptime(void)
 uint64
 sys_page_fault_num(void)
 {
-    return myproc()->page_fault_counter;
+    return myvm()->page_fault_counter;
+}
+
+uint64
+sys_getrusage(void)
+{
+  int pid;
+  uint64 ru; // user pointer to struct rusage
+
+  if(argint(0, &pid) < 0 || argaddr(1, &ru) < 0)
+    return -1;
+  return getrusage(pid, ru);
+}
+
+uint64
+sys_quantum(void)
+{
+  int usec;
+
+  if(argint(0, &usec) < 0)
+    return -1;
+  return quantum(usec);
+}
+
+uint64
+sys_pagestat(void)
+{
+  int pid;
+  uint64 st; // user pointer to struct pagestat
+
+  if(argint(0, &pid) < 0 || argaddr(1, &st) < 0)
+    return -1;
+  return pagestat(pid, st);
+}
+
+uint64
+sys_clone(void)
+{
+  uint64 fn, arg, stack;
+
+  if(argaddr(0, &fn) < 0 || argaddr(1, &arg) < 0 || argaddr(2, &stack) < 0)
+    return -1;
+  return clone(fn, arg, stack);
+}
+
+uint64
+sys_futex(void)
+{
+  uint64 addr;
+  int op, val;
+
+  if(argaddr(0, &addr) < 0 || argint(1, &op) < 0 || argint(2, &val) < 0)
+    return -1;
+  return futex(addr, op, val);
+}
+
+uint64
+sys_lockstat(void)
+{
+  uint64 info; // user pointer to struct lockinfo[n]
+  int n, reset;
+
+  if(argaddr(0, &info) < 0 || argint(1, &n) < 0 || argint(2, &reset) < 0)
+    return -1;
+  return lockstat(info, n, reset);
+}
+
+uint64
+sys_lockbench(void)
+{
+  int fair, n;
+  uint64 hist; // user pointer to uint[NLOCKBENCH]
+
+  if(argint(0, &fair) < 0 || argint(1, &n) < 0 || argaddr(2, &hist) < 0)
+    return -1;
+  return lockbench(fair, n, hist);
+}
+
+uint64
+sys_bcachestat(void)
+{
+  uint64 st; // user pointer to struct bcachestat
+  int max;
+
+  if(argaddr(0, &st) < 0 || argint(1, &max) < 0)
+    return -1;
+  return bcachestat(st, max);
 }
@@ -0,0 +1,161 @@
+// Per-hart timers.
+//
+// Each hart programs its own CLINT timer, through timervec in
+// kernelvec.S, for the next thing it has to do: the next
+// scheduling tick of the process it is running, and the
+// earliest deadline of the timed sleeps on its timer wheel.
+// An idle hart has no tick, so it isn't woken up for nothing;
+// a hart that queues work for an idle one, or that queues work
+// on a busy one while another idles, sends it an IPI.
+//
+// Lock order: a timerq's lock, then the wait queue and
+// p->lock locks wakeup() takes.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+
+// requests to timervec, in a7.
+#define SBI_SET_TIMER 0
+#define SBI_SEND_IPI  1
+
+static void
+sbi_call(uint64 req, uint64 arg) {
+    register uint64 a0 asm("a0") = arg;
+    register uint64 a7 asm("a7") = req;
+    asm volatile("ecall" : "+r" (a0) : "r" (a7) : "memory");
+}
+
+void
+timerqinit(void) {
+    for (struct cpu *c = cpus; c < &cpus[NCPU]; c++) {
+        initlock(&c->tq.lock, "timerq");
+        c->tq.armed = -1;
+    }
+}
+
+// Set this hart's timer for the earliest of its timed sleeps
+// and, if busy, its scheduling tick. Caller must hold the
+// hart's tq.lock.
+static void
+timer_arm(struct cpu *c, int busy) {
+    struct timerq *tq = &c->tq;
+    uint64 next = -1;
+
+    for (int i = 0; i < NTIMERWHEEL; i++) {
+        if (tq->wheel[i] && tq->wheel[i]->deadline < next)
+            next = tq->wheel[i]->deadline;
+    }
+    if (busy && tq->tick < next)
+        next = tq->tick;
+    if (next != tq->armed) {
+        tq->armed = next;
+        sbi_call(SBI_SET_TIMER, next);
+    }
+}
+
+// Called by the scheduler on its way to run a process with
+// left cycles of its time slice to go, or with left 0 to
+// wait for an interrupt: start or stop the tick. The tick
+// comes at least every sched_quantum, so a process of a
+// higher level doesn't wait out a long slice.
+void
+timer_rearm(uint64 left) {
+    struct cpu *c;
+
+    push_off();
+    c = mycpu();
+    acquire(&c->tq.lock);
+    if (left)
+        c->tq.tick = r_time() + (left < sched_quantum ? left : sched_quantum);
+    timer_arm(c, left != 0);
+    release(&c->tq.lock);
+    pop_off();
+}
+
+// Interrupt hart id, which is waiting for work in wfi.
+void
+timer_kick(int id) {
+    sbi_call(SBI_SEND_IPI, id);
+}
+
+// Handle this hart's timer (or an IPI; they look the same):
+// end the timed sleeps that are due, and set the timer again.
+// Returns 1 if the running process's tick is due.
+int
+timer_intr(uint64 now) {
+    struct cpu *c = mycpu();
+    struct timerq *tq = &c->tq;
+    struct proc *p, **slot;
+    uint64 t = now / TICK_INTERVAL;
+    uint64 from;
+    int tick = 0;
+
+    acquire(&tq->lock);
+    from = tq->done;
+    if (t - from >= NTIMERWHEEL)
+        from = t - NTIMERWHEEL + 1;
+    for (; from <= t; from++) {
+        slot = &tq->wheel[from % NTIMERWHEEL];
+        while ((p = *slot) != 0 && p->deadline <= now) {
+            *slot = p->tq_next;
+            p->tq = 0;
+            wakeup(&p->deadline);
+        }
+    }
+    tq->done = t;
+    if (c->proc && now >= tq->tick) {
+        tick = 1;
+        tq->tick = now + sched_quantum;
+    }
+    tq->armed = -1; // timervec turned it off
+    timer_arm(c, c->proc != 0);
+    release(&tq->lock);
+    return tick;
+}
+
+// Sleep until the timer reaches when, on the wheel of the
+// hart we're on. Return -1 if killed first.
+int
+sleep_until(uint64 when) {
+    struct proc *p = myproc();
+    struct cpu *c;
+    struct timerq *tq;
+    struct proc **pp;
+
+    while (r_time() < when) {
+        if (p->killed)
+            return -1;
+        push_off();
+        c = mycpu();
+        tq = &c->tq;
+        acquire(&tq->lock);
+        pop_off();
+
+        pp = &tq->wheel[(when / TICK_INTERVAL) % NTIMERWHEEL];
+        while (*pp && (*pp)->deadline <= when)
+            pp = &(*pp)->tq_next;
+        p->deadline = when;
+        p->tq_next = *pp;
+        *pp = p;
+        p->tq = tq;
+        timer_arm(c, 1);
+
+        sleep(&p->deadline, &tq->lock);
+
+        // still on the wheel if kill() woke us
+        if (p->tq) {
+            pp = &tq->wheel[(when / TICK_INTERVAL) % NTIMERWHEEL];
+            while (*pp != p)
+                pp = &(*pp)->tq_next;
+            *pp = p->tq_next;
+            p->tq = 0;
+        }
+        release(&tq->lock);
+    }
+    return 0;
+}
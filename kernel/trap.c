@@ -44,6 +44,7 @@ usertrap(void) {
     w_stvec((uint64) kernelvec);
 
     struct proc *p = myproc();
+    runtime_charge(p, 1);
 
     // save user program counter.
     p->trapframe->epc = r_sepc();
@@ -65,18 +66,28 @@ usertrap(void) {
         syscall();
     } else if ((which_dev = devintr()) != 0) {
         // ok
-    } else if (!is_none_policy() && p->pid > 2 && (r_scause() == 13 || r_scause() == 15 || r_scause() == 12 )){
-        if(page_in_file(r_stval(), p->pagetable)){
-            get_page_from_file(r_stval());
+    } else if ((r_scause() == 13 || r_scause() == 15 || r_scause() == 12) && tlb_spurious_fault(p->leader, r_stval(), r_scause())) {
+        // stale TLB entry for a page that has since been mapped; retry.
+    } else if (!is_none_policy() && p->leader->pid > 2 && (r_scause() == 13 || r_scause() == 15 || r_scause() == 12 )){
+        // paging may sleep, and then other traps change these.
+        uint64 scause = r_scause(), stval = r_stval();
+        uint64 t0 = r_time();
+        vmlock(p->leader);
+        if(page_in_file(stval, p->pagetable)){
+            get_page_from_file(stval);
+            p->ftime += r_time() - t0;
+        }
+        else if(tlb_spurious_fault(p->leader, stval, scause)){
+            // another thread paged it in while we waited.
         }
         else{
-            printf("PID: %d inside usertrap(): page: %p is not in file\n", p->pid,r_stval());
-            printf("usertrap(): unexpected scause %d pid=%d\n", r_scause(), p->pid);
-            printf("            sepc=%p stval=%p\n", r_sepc(), r_stval());
-            print_memory_metadata_state(p);
+            printf("PID: %d inside usertrap(): page: %p is not in file\n", p->pid,stval);
+            printf("usertrap(): unexpected scause %d pid=%d\n", scause, p->pid);
+            printf("            sepc=%p stval=%p\n", p->trapframe->epc, stval);
+            print_memory_metadata_state(p->leader);
             p->killed = 1;
         }
-
+        vmunlock(p->leader);
     }
     else {
         printf("usertrap(): unexpected scause %d pid=%d\n", r_scause(), p->pid);
@@ -86,9 +97,11 @@ usertrap(void) {
 
     if (p->killed)
         exit(-1);
-    // give up the CPU if this is a timer interrupt.
+    // after the trap is handled: aging may sleep on vmlock().
+    page_aging(p);
+    // charge the time slice if this is a timer interrupt.
     if (which_dev == 2)
-        yield();
+        sched_tick();
 
     usertrapret();
 }
@@ -127,14 +140,20 @@ usertrapret(void) {
     // set S Exception Program Counter to the saved user pc.
     w_sepc(p->trapframe->epc);
 
+    // drop our stale translations if another hart changed
+    // the page table since we last ran here.
+    tlb_sync(p->leader);
+
+    runtime_charge(p, 0);
+
     // tell trampoline.S the user page table to switch to.
-    uint64 satp = MAKE_SATP(p->pagetable);
+    uint64 satp = MAKE_SATP_ASID(p->pagetable, hart_asid(p->leader));
 
     // jump to trampoline.S at the top of memory, which
     // switches to the user page table, restores user registers,
     // and switches to user mode with sret.
     uint64 fn = TRAMPOLINE + (userret - trampoline);
-    ((void (*)(uint64, uint64)) fn)(TRAPFRAME, satp);
+    ((void (*)(uint64, uint64)) fn)(THREADFRAME(p->tfslot), satp);
 }
 
 // interrupts and exceptions from kernel code go here via kernelvec,
@@ -158,27 +177,36 @@ kerneltrap() {
         panic("kerneltrap");
     }
 
-    // give up the CPU if this is a timer interrupt.
+    // charge the time slice if this is a timer interrupt.
     if (which_dev == 2 && myproc() != 0 && myproc()->state == RUNNING)
-        yield();
+        sched_tick();
 
-    // the yield() may have caused some traps to occur,
+    // the sched_tick() may have caused some traps to occur,
     // so restore trap registers for use by kernelvec.S's sepc instruction.
     w_sepc(sepc);
     w_sstatus(sstatus);
 }
 
+// Bring ticks up to date with the timer. Idle harts take no
+// clock interrupts, so it is kept by whichever hart is awake.
 void
-clockintr() {
+tickupdate(void) {
     acquire(&tickslock);
-    ticks++;
-    wakeup(&ticks);
+    if (r_time() / TICK_INTERVAL > ticks)
+        ticks = r_time() / TICK_INTERVAL;
     release(&tickslock);
 }
 
+// Returns 1 if the running process's tick is due.
+int
+clockintr() {
+    tickupdate();
+    return timer_intr(r_time());
+}
+
 // check if it's an external interrupt or software interrupt,
 // and handle it.
-// returns 2 if timer interrupt,
+// returns 2 if timer interrupt with a tick due,
 // 1 if other device,
 // 0 if not recognized.
 int
@@ -207,18 +235,21 @@ devintr() {
 
         return 1;
     } else if (scause == 0x8000000000000001L) {
-        // software interrupt from a machine-mode timer interrupt,
-        // forwarded by timervec in kernelvec.S.
-
-        if (cpuid() == 0) {
-            clockintr();
-        }
+        // software interrupt from a machine-mode timer interrupt
+        // or IPI, forwarded by timervec in kernelvec.S.
 
         // acknowledge the software interrupt by clearing
         // the SSIP bit in sip.
         w_sip(r_sip() & ~2);
 
-        return 2;
+        // it may be a tlb_shootdown() of the running thread's
+        // address space.
+        if (myproc())
+            tlb_sync(myproc()->leader);
+
+        if (clockintr())
+            return 2;
+        return 1;
     } else {
         return 0;
     }
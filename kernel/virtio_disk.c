@@ -63,6 +63,7 @@ static struct disk {
   struct {
     struct buf *b;
     char status;
+    char async;   // nobody waits: virtio_disk_intr() calls bdone()
   } info[NUM];
 
   // disk command headers.
@@ -184,12 +185,11 @@ free_chain(int i)
   }
 }
 
-// allocate three descriptors (they need not be contiguous).
-// disk transfers always use three descriptors.
+// allocate n descriptors (they need not be contiguous).
 static int
-alloc3_desc(int *idx)
+alloc_descs(int *idx, int n)
 {
-  for(int i = 0; i < 3; i++){
+  for(int i = 0; i < n; i++){
     idx[i] = alloc_desc();
     if(idx[i] < 0){
       for(int j = 0; j < i; j++)
@@ -200,27 +200,34 @@ alloc3_desc(int *idx)
   return 0;
 }
 
-void
-virtio_disk_rw(struct buf *b, int write)
+// start a disk transfer of the n buffers in bs, which hold
+// consecutive blocks, as one request, and return the index of
+// the first descriptor of its chain. if there are not enough
+// free descriptors, wait for some, or return -1 if nowait.
+// virtio_disk_intr() clears bs[0]->disk when it is done.
+// caller must hold vdisk_lock.
+static int
+virtio_disk_start(struct buf **bs, int n, int write, int nowait)
 {
-  uint64 sector = b->blockno * (BSIZE / 512);
-
-  acquire(&disk.vdisk_lock);
+  uint64 sector = bs[0]->blockno * (BSIZE / 512);
 
   // the spec's Section 5.2 says that legacy block operations use
   // three descriptors: one for type/reserved/sector, one for the
-  // data, one for a 1-byte status result.
+  // data, one for a 1-byte status result. the data may be
+  // scattered over several descriptors, one per buffer here.
 
-  // allocate the three descriptors.
-  int idx[3];
+  // allocate the descriptors.
+  int idx[NUM];
   while(1){
-    if(alloc3_desc(idx) == 0) {
+    if(alloc_descs(idx, n + 2) == 0) {
       break;
     }
+    if(nowait)
+      return -1;
     sleep(&disk.free[0], &disk.vdisk_lock);
   }
 
-  // format the three descriptors.
+  // format the descriptors.
   // qemu's virtio-blk.c reads them.
 
   struct virtio_blk_req *buf0 = &disk.ops[idx[0]];
@@ -237,24 +244,27 @@ virtio_disk_rw(struct buf *b, int write)
   disk.desc[idx[0]].flags = VRING_DESC_F_NEXT;
   disk.desc[idx[0]].next = idx[1];
 
-  disk.desc[idx[1]].addr = (uint64) b->data;
-  disk.desc[idx[1]].len = BSIZE;
-  if(write)
-    disk.desc[idx[1]].flags = 0; // device reads b->data
-  else
-    disk.desc[idx[1]].flags = VRING_DESC_F_WRITE; // device writes b->data
-  disk.desc[idx[1]].flags |= VRING_DESC_F_NEXT;
-  disk.desc[idx[1]].next = idx[2];
+  for(int i = 1; i <= n; i++){
+    disk.desc[idx[i]].addr = (uint64) bs[i-1]->data;
+    disk.desc[idx[i]].len = BSIZE;
+    if(write)
+      disk.desc[idx[i]].flags = 0; // device reads b->data
+    else
+      disk.desc[idx[i]].flags = VRING_DESC_F_WRITE; // device writes b->data
+    disk.desc[idx[i]].flags |= VRING_DESC_F_NEXT;
+    disk.desc[idx[i]].next = idx[i+1];
+  }
 
   disk.info[idx[0]].status = 0xff; // device writes 0 on success
-  disk.desc[idx[2]].addr = (uint64) &disk.info[idx[0]].status;
-  disk.desc[idx[2]].len = 1;
-  disk.desc[idx[2]].flags = VRING_DESC_F_WRITE; // device writes the status
-  disk.desc[idx[2]].next = 0;
+  disk.desc[idx[n+1]].addr = (uint64) &disk.info[idx[0]].status;
+  disk.desc[idx[n+1]].len = 1;
+  disk.desc[idx[n+1]].flags = VRING_DESC_F_WRITE; // device writes the status
+  disk.desc[idx[n+1]].next = 0;
 
   // record struct buf for virtio_disk_intr().
-  b->disk = 1;
-  disk.info[idx[0]].b = b;
+  bs[0]->disk = 1;
+  disk.info[idx[0]].b = bs[0];
+  disk.info[idx[0]].async = 0;
 
   // tell the device the first index in our chain of descriptors.
   disk.avail->ring[disk.avail->idx % NUM] = idx[0];
@@ -268,17 +278,67 @@ virtio_disk_rw(struct buf *b, int write)
 
   *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
 
+  return idx[0];
+}
+
+void
+virtio_disk_rw(struct buf *b, int write)
+{
+  acquire(&disk.vdisk_lock);
+
+  virtio_disk_start(&b, 1, write, 0);
+
   // Wait for virtio_disk_intr() to say request has finished.
   while(b->disk == 1) {
     sleep(b, &disk.vdisk_lock);
   }
 
-  disk.info[idx[0]].b = 0;
-  free_chain(idx[0]);
+  release(&disk.vdisk_lock);
+}
+
+// read or write the n locked buffers in bs, and wait for all
+// of them. each run of buffers holding consecutive blocks is
+// one request, and all the requests are started before any is
+// waited for, so the device sees them together.
+void
+virtio_disk_rwv(struct buf **bs, int n, int write)
+{
+  int i, run;
+
+  acquire(&disk.vdisk_lock);
+
+  for(i = 0; i < n; i += run){
+    for(run = 1; i + run < n && run < NUM - 2; run++){
+      if(bs[i+run]->blockno != bs[i]->blockno + run)
+        break;
+    }
+    virtio_disk_start(bs + i, run, write, 0);
+  }
+
+  // Wait for virtio_disk_intr() to say the requests have
+  // finished; only the first buffer of each is marked.
+  for(i = 0; i < n; i++){
+    while(bs[i]->disk == 1)
+      sleep(bs[i], &disk.vdisk_lock);
+  }
 
   release(&disk.vdisk_lock);
 }
 
+// start reading locked buffer b, and return without waiting.
+// virtio_disk_intr() hands b to bdone() when the data is in.
+// returns -1, and reads nothing, if the device is busy.
+int
+virtio_disk_read_async(struct buf *b)
+{
+  acquire(&disk.vdisk_lock);
+  int id = virtio_disk_start(&b, 1, 0, 1);
+  if(id >= 0)
+    disk.info[id].async = 1;
+  release(&disk.vdisk_lock);
+  return id < 0 ? -1 : 0;
+}
+
 void
 virtio_disk_intr()
 {
@@ -306,7 +366,15 @@ virtio_disk_intr()
 
     struct buf *b = disk.info[id].b;
     b->disk = 0;   // disk is done with buf
-    wakeup(b);
+    disk.info[id].b = 0;
+    free_chain(id);
+    if(disk.info[id].async){
+      // no one sleeps on it.
+      disk.info[id].async = 0;
+      bdone(b);
+    } else {
+      wakeup(b);
+    }
 
     disk.used_idx += 1;
   }
@@ -7,6 +7,7 @@
 #include "fs.h"
 #include "spinlock.h"
 #include "proc.h"
+#include "pagestat.h"
 
 
 /*
@@ -18,6 +19,13 @@ extern char etext[];  // kernel.ld sets this to end of kernel code.
 
 extern char trampoline[]; // trampoline.S
 
+// flushing more pages than this at once costs more than
+// dropping the whole address space from the TLB.
+#define TLB_FLUSH_MAX_PAGES 16
+#define TLB_FLUSH_ALL ((uint64) -1)
+
+static void copy_drain(struct proc *);
+
 // Make a direct-map page table for the kernel.
 pagetable_t
 kvmmake(void) {
@@ -58,9 +66,15 @@ kvminit(void) {
 }
 
 // Switch h/w page table register to the kernel's page table,
-// and enable paging.
+// and enable paging. Probe the ASID bits this hart implements
+// on the way: the ASID field of satp keeps only those. A hart
+// with too few to give each proc its own runs user page tables
+// with ASID 0, like the kernel, and trampoline.S then flushes
+// the TLB whenever it switches satp.
 void
 kvminithart() {
+    w_satp(MAKE_SATP_ASID(kernel_pagetable, SATP_ASID_MAX));
+    mycpu()->asids = ((r_satp() >> SATP_ASID_SHIFT) & SATP_ASID_MAX) >= NPROC;
     w_satp(MAKE_SATP(kernel_pagetable));
     sfence_vma();
 }
@@ -180,6 +194,7 @@ void
 uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free) {
     uint64 a;
     pte_t *pte;
+    struct proc *p = myvm();
     if ((va % PGSIZE) != 0)
         panic("uvmunmap: not aligned");
     for (a = va; a < va + npages * PGSIZE; a += PGSIZE) {
@@ -200,12 +215,19 @@ uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free) {
             // page is in memory
             remove_from_memory_meta_data(a, pagetable);
         }
-//        else if (!is_none_policy() && (*pte & PTE_PG) != 0) {
-//            // page is in file
-//            remove_from_file_meta_data(a, pagetable);
-//        }
+        else if (!is_none_policy() && (*pte & PTE_PG) != 0) {
+            // page is in file: give its swap slot back
+            remove_from_file_meta_data(a, pagetable);
+        }
         *pte = 0;
     }
+    // one flush for the whole range; a page table that isn't
+    // live gets its ASID flushed in allocproc() or exec().
+    if (p != 0 && p->pagetable == pagetable) {
+        tlb_flush(p, va, npages);
+        if (p->nthreads > 1)
+            tlb_shootdown(p);
+    }
 }
 
 // create an empty user page table.
@@ -235,6 +257,75 @@ uvminit(pagetable_t pagetable, uchar *src, uint sz) {
     memmove(mem, src, sz);
 }
 
+// The ASID p's translations are tagged with on this hart.
+// Interrupts must be disabled.
+uint64
+hart_asid(struct proc *p) {
+    return mycpu()->asids ? p->asid : 0;
+}
+
+// Invalidate npages of p's user translations starting at va.
+// This hart gets targeted fences, or one fence for p's whole
+// ASID when the range is large; every other hart is marked to
+// flush p's ASID in tlb_sync() before it next runs p.
+void
+tlb_flush(struct proc *p, uint64 va, uint64 npages) {
+    uint64 a;
+
+    push_off();
+    if (npages > TLB_FLUSH_MAX_PAGES) {
+        sfence_vma_asid(hart_asid(p));
+    } else {
+        for (a = va; a < va + npages * PGSIZE; a += PGSIZE)
+            sfence_vma_page(a, hart_asid(p));
+    }
+    __sync_fetch_and_or(&p->tlb_stale, ((1 << NCPU) - 1) & ~(1 << cpuid()));
+    pop_off();
+}
+
+// Drop every translation tagged with p's ASID, on all harts.
+void
+tlb_flush_asid(struct proc *p) {
+    tlb_flush(p, 0, TLB_FLUSH_ALL);
+}
+
+// Called on the way back to user space, interrupts off.
+// Flush p's ASID if the page table changed while this hart
+// was holding translations from an earlier run of p.
+void
+tlb_sync(struct proc *p) {
+    uint bit = 1 << cpuid();
+
+    if (p->tlb_stale & bit) {
+        __sync_fetch_and_and(&p->tlb_stale, ~bit);
+        sfence_vma_asid(hart_asid(p));
+    }
+}
+
+// A page fault on a page whose PTE already allows the access
+// came from a stale TLB entry (we don't fence when mapping a
+// page in). Flush that one page and return 1 so the user
+// instruction is retried; return 0 for a real fault.
+int
+tlb_spurious_fault(struct proc *p, uint64 va, uint64 scause) {
+    pte_t *pte;
+    uint64 need;
+
+    if (va >= MAXVA || (pte = walk(p->pagetable, va, 0)) == 0)
+        return 0;
+    if (scause == 12)
+        need = PTE_X;
+    else if (scause == 13)
+        need = PTE_R;
+    else
+        need = PTE_W;
+    if ((*pte & (PTE_V | PTE_U | need)) != (PTE_V | PTE_U | need))
+        return 0;
+    sfence_vma_page(PGROUNDDOWN(va), hart_asid(p));
+    p->pgstat.tlb_faults++;
+    return 1;
+}
+
 int is_none_policy() {
 #ifdef NONE
     return 1;
@@ -242,35 +333,101 @@ int is_none_policy() {
     return 0;
 }
 
-void swap(pagetable_t pagetable, uint64 user_page_va) {
-    struct proc *p = myproc();
-    // move selected page from memory to swapFile
-    int out_index = get_swap_out_page_index();
-    pte_t *pte = walk(p->pagetable, p->memory_pages[out_index].user_page_VA, 0);
-    uint64 out_page_pa = PTE2PA(*pte);
-    write_page_to_file(p, p->memory_pages[out_index].user_page_VA, p->pagetable);
-    // clear the page from memory
-    kfree((void *) out_page_pa); //free swapped page
-    p->memory_pages[out_index].state = P_UNUSED;
-    update_page_out_pte(p->pagetable, p->memory_pages[out_index].user_page_VA);
-    // move the requested page to memory
-    add_to_memory_page_metadata(pagetable, user_page_va);
+// The PG_* paging policy the kernel was built with.
+int paging_policy() {
+#ifdef SCFIFO
+    return PG_SCFIFO;
+#endif
+#ifdef NFUA
+    return PG_NFUA;
+#endif
+#ifdef LAPA
+    return PG_LAPA;
+#endif
+#ifdef DEBUG
+    return PG_DEBUG;
+#endif
+    return PG_NONE;
+}
+
+// Move the resident pages of pagetable described by pages[0..n-1]
+// (copies of their memory_pages entries) to swap: update all
+// their PTEs and flush the TLB in one go, then write them out and
+// free the frames. Unmapping first keeps other threads from
+// writing to a page after it was copied to swap. The caller has
+// already dropped them from memory_pages.
+void
+evict_pages(pagetable_t pagetable, struct page_metadata_struct *pages, int n) {
+    struct proc *p = myvm();
+    uint64 pas[MAX_PYSC_PAGES];
+    pte_t *pte;
+    int i;
+
+    if (n <= 0)
+        return;
+    // in VA order, so that neighbouring pages get neighbouring slots.
+    for (i = 1; i < n; i++) {
+        struct page_metadata_struct pg = pages[i];
+        int j;
+        for (j = i; j > 0 && pages[j - 1].user_page_VA > pg.user_page_VA; j--)
+            pages[j] = pages[j - 1];
+        pages[j] = pg;
+    }
+    for (i = 0; i < n; i++) {
+        if ((pte = walk(pagetable, pages[i].user_page_VA, 0)) == 0 || (*pte & PTE_V) == 0)
+            panic("evict_pages: not resident");
+        pas[i] = PTE2PA(*pte);
+    }
+    for (i = 0; i < n; i++)
+        update_page_out_pte(pagetable, pages[i].user_page_VA);
+    if (p->pagetable == pagetable) {
+        for (i = 0; i < n; i++)
+            tlb_flush(p, pages[i].user_page_VA, 1);
+        if (p->nthreads > 1)
+            tlb_shootdown(p);
+        // a copy by another thread may still be using a frame.
+        copy_drain(p);
+    }
+    if (write_pages_to_file(p, pages, pas, n, pagetable) < 0)
+        panic("evict_pages: write");
+    for (i = 0; i < n; i++)
+        kfree((void *) pas[i]);
+}
+
+// Make room for k more pages in memory by evicting the k
+// coldest resident pages, chosen in one policy pass.
+// Returns the number of pages evicted.
+int
+swap_out_pages(pagetable_t pagetable, int k) {
+    struct proc *p = myvm();
+    int victims[MAX_PYSC_PAGES];
+    struct page_metadata_struct pages[MAX_PYSC_PAGES];
+    int i, n;
+
+    if (k > MAX_PYSC_PAGES)
+        k = MAX_PYSC_PAGES;
+    if (k > MAX_TOTAL_PAGES - MAX_PYSC_PAGES - p->pages_in_file_counter)
+        k = MAX_TOTAL_PAGES - MAX_PYSC_PAGES - p->pages_in_file_counter;
+    n = get_swap_out_pages(victims, k);
+    for (i = 0; i < n; i++) {
+        pages[i] = p->memory_pages[victims[i]];
+        p->memory_pages[victims[i]].state = P_UNUSED;
+    }
+    evict_pages(pagetable, pages, n);
+    return n;
 }
 
 // Allocate PTEs and physical memory to grow process from oldsz to
 // newsz, which need not be page aligned.  Returns new size or 0 on error.
 uint64
 uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz) {
-    struct proc *p = myproc();
+    struct proc *p = myvm();
     char *mem;
     uint64 a;
     if (newsz < oldsz)
         return oldsz;
     oldsz = PGROUNDUP(oldsz);
-    int num_of_new_page = 0;
-    int old_num_of_pages_in_mem = p->pages_in_memory_counter;
     for (a = oldsz; a < newsz; a += PGSIZE) {
-        num_of_new_page++;
         mem = kalloc();
         if (mem == 0) {
             uvmdealloc(pagetable, a, oldsz);
@@ -290,14 +447,12 @@ uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz) {
                 uvmdealloc(pagetable, a, oldsz);
                 panic("uvmalloc(): Proc is too big\n");
             }
-            else if (old_num_of_pages_in_mem + num_of_new_page > MAX_PYSC_PAGES) {
-                // no more space in memory need to swap
-                swap(pagetable, a);
-            }
-                // have space in memory
-            else {
-                add_to_memory_page_metadata(pagetable, a);
+            if (p->pages_in_memory_counter >= MAX_PYSC_PAGES) {
+                // no more space in memory: evict enough pages for the
+                // rest of this allocation at once, not one per page.
+                swap_out_pages(pagetable, (PGROUNDUP(newsz) - a) / PGSIZE);
             }
+            add_to_memory_page_metadata(pagetable, a);
         }
     }
     return newsz;
@@ -403,22 +558,117 @@ uvmclear(pagetable_t pagetable, uint64 va) {
     *pte &= ~PTE_U;
 }
 
+// Copies between the kernel and user memory. Another thread of
+// the address space may page out the frame behind a user address
+// while the kernel copies to or from it, so a copy pins the
+// address space (vm->npinned) while it uses a frame, and
+// evict_pages() waits for the pins to go after it has unmapped
+// its pages, before it reads or frees their frames. A pinned
+// copy only moves bytes, so copies may be made under spinlocks.
+// A page that is in swap is brought back if the copy may sleep:
+// no spinlocks held (interrupts on) and not p->nofault.
+
+static void
+copy_unpin(struct proc *vm) {
+    if (vm == 0)
+        return;
+    acquire(&vm->vmlk);
+    if (--vm->npinned == 0)
+        wakeup(&vm->npinned);
+    release(&vm->vmlk);
+}
+
+// Wait until no copy uses a frame of vm's. Caller holds vmlock(vm).
+static void
+copy_drain(struct proc *vm) {
+    acquire(&vm->vmlk);
+    while (vm->npinned > 0)
+        sleep(&vm->npinned, &vm->vmlk);
+    release(&vm->vmlk);
+}
+
+// Return the frame behind user address va of pagetable, or 0,
+// with the address space pinned if it is shared; *vmp is set
+// for copy_unpin(). A copy out marks the page dirty, since the
+// kernel writes through its own mapping, which sets no PTE_D.
+static uint64
+copy_pin(pagetable_t pagetable, uint64 va, int write, struct proc **vmp) {
+    struct proc *p = myproc();
+    struct proc *vm = 0, *pin = 0;
+    uint64 bits = write ? PTE_A | PTE_D : PTE_A;
+    pte_t *pte;
+
+    *vmp = 0;
+    if (va >= MAXVA)
+        return 0;
+    // exec() copies to a page table no one runs yet.
+    if (p && p->leader->pagetable == pagetable)
+        vm = p->leader;
+    for (;;) {
+        // with one thread, nothing runs alongside us in vm.
+        if (vm && vm->nthreads > 1) {
+            pin = vm;
+            acquire(&vm->vmlk);
+            vm->npinned++;
+            release(&vm->vmlk);
+        }
+        pte = walk(pagetable, va, 0);
+        if (pte && (*pte & (PTE_V | PTE_U)) == (PTE_V | PTE_U)) {
+            // atomically: the MMU sets PTE_D for other threads.
+            if ((*pte & bits) != bits)
+                __sync_fetch_and_or(pte, bits);
+            *vmp = pin;
+            return PTE2PA(*pte);
+        }
+        copy_unpin(pin);
+        pin = 0;
+        if (vm == 0 || pte == 0 || (*pte & PTE_PG) == 0 ||
+            !intr_get() || p->nofault || uvmpagein(va, 1) < 0)
+            return 0;
+    }
+}
+
+// Bring the pages of [va, va+len) of the current address space
+// back from swap. Returns -1 if some page of it isn't there for
+// the user. The caller must be able to sleep, and must hold no
+// buffer or transaction: making room writes to the swap file.
+int
+uvmpagein(uint64 va, uint64 len) {
+    struct proc *vm = myvm();
+    uint64 a;
+    int r = 0;
+
+    vmlock(vm);
+    for (a = PGROUNDDOWN(va); r == 0 && a < va + len; a += PGSIZE) {
+        if (page_in_file(a, vm->pagetable)) {
+            if (get_page_from_file(a) == 0)
+                r = -1;
+        } else if (walkaddr(vm->pagetable, a) == 0) {
+            r = -1;
+        }
+    }
+    vmunlock(vm);
+    return r;
+}
+
 // Copy from kernel to user.
 // Copy len bytes from src to virtual address dstva in a given page table.
 // Return 0 on success, -1 on error.
 int
 copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len) {
     uint64 n, va0, pa0;
+    struct proc *vm;
 
     while (len > 0) {
         va0 = PGROUNDDOWN(dstva);
-        pa0 = walkaddr(pagetable, va0);
+        pa0 = copy_pin(pagetable, va0, 1, &vm);
         if (pa0 == 0)
             return -1;
         n = PGSIZE - (dstva - va0);
         if (n > len)
             n = len;
         memmove((void *) (pa0 + (dstva - va0)), src, n);
+        copy_unpin(vm);
 
         len -= n;
         src += n;
@@ -433,16 +683,18 @@ copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len) {
 int
 copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len) {
     uint64 n, va0, pa0;
+    struct proc *vm;
 
     while (len > 0) {
         va0 = PGROUNDDOWN(srcva);
-        pa0 = walkaddr(pagetable, va0);
+        pa0 = copy_pin(pagetable, va0, 0, &vm);
         if (pa0 == 0)
             return -1;
         n = PGSIZE - (srcva - va0);
         if (n > len)
             n = len;
         memmove(dst, (void *) (pa0 + (srcva - va0)), n);
+        copy_unpin(vm);
 
         len -= n;
         dst += n;
@@ -459,10 +711,11 @@ int
 copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max) {
     uint64 n, va0, pa0;
     int got_null = 0;
+    struct proc *vm;
 
     while (got_null == 0 && max > 0) {
         va0 = PGROUNDDOWN(srcva);
-        pa0 = walkaddr(pagetable, va0);
+        pa0 = copy_pin(pagetable, va0, 0, &vm);
         if (pa0 == 0)
             return -1;
         n = PGSIZE - (srcva - va0);
@@ -483,6 +736,7 @@ copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max) {
             p++;
             dst++;
         }
+        copy_unpin(vm);
 
         srcva = va0 + PGSIZE;
     }
@@ -495,7 +749,7 @@ copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max) {
 
 
 int get_free_memory_page_index() {
-    struct proc *p = myproc();
+    struct proc *p = myvm();
     if (p == 0)
         return -1;
     for (int i = 0; i < MAX_PYSC_PAGES; i++) {
@@ -513,7 +767,7 @@ void update_page_out_pte(pagetable_t pagetable, uint64 user_page_va) {
     *pte &= PTE_FLAGS(*pte); // clear junk physical address
     *pte |= PTE_PG; // turn on Paged out to storage bit
     *pte &= ~PTE_V; // turn off valid bit
-    sfence_vma(); //flush the TLB
+    // the caller flushes the TLB, once for all the pages it moved.
 }
 
 void update_page_in_pte(pagetable_t pagetable, uint64 user_page_va, uint64 page_pa, int index) {
@@ -525,24 +779,26 @@ void update_page_in_pte(pagetable_t pagetable, uint64 user_page_va, uint64 page_
     *pte |= PA2PTE(page_pa); // Map PTE to the new_page
     *pte |= PTE_W | PTE_X | PTE_R | PTE_U | PTE_V; // Turn on needed flags
     *pte &= ~PTE_PG; // page is back in memory turn off Paged out bit
+    *pte &= ~PTE_D; // clean until written, see write_pages_to_file()
 #ifdef NFUA
-    struct proc *p = myproc();
+    struct proc *p = myvm();
     p->memory_pages[index].access_count = 0;
 #endif
 #ifdef LAPA
-    struct proc *p = myproc();
+    struct proc *p = myvm();
     p->memory_pages[index].access_count = 0xFFFFFFFF;
 #endif
-    sfence_vma(); // flush the TLB
-
+    // invalid -> valid needs no flush; a stale TLB entry only
+    // causes a spurious fault, see tlb_spurious_fault().
 }
 
 void add_to_memory_page_metadata(pagetable_t pagetable, uint64 user_page_va) {
-    struct proc *p = myproc();
+    struct proc *p = myvm();
     int free_index = get_free_memory_page_index();
     p->memory_pages[free_index].state = P_USED;
     p->memory_pages[free_index].user_page_VA = user_page_va;
     p->memory_pages[free_index].page_order = p->page_order_counter++;
+    p->memory_pages[free_index].swap = 0;
     p->pages_in_memory_counter++;
 #ifdef NFUA
     p->memory_pages[free_index].access_count = 0;
@@ -553,7 +809,7 @@ void add_to_memory_page_metadata(pagetable_t pagetable, uint64 user_page_va) {
 }
 
 int get_page_from_file(uint64 r_stval) {
-    struct proc *p = myproc();
+    struct proc *p = myvm();
     p->page_fault_counter++;
     uint64 user_page_va = PGROUNDDOWN(r_stval);
     char *new_page = kalloc();
@@ -563,33 +819,34 @@ int get_page_from_file(uint64 r_stval) {
     memset(new_page, 0, PGSIZE);
     int free_index = get_free_memory_page_index();
     // have free space in the memory
+    // map the page only once it is read in: other threads
+    // may use it as soon as it is mapped.
     if (free_index >= 0) {
-        update_page_in_pte(p->pagetable, user_page_va, (uint64) new_page, free_index);
         read_page_from_file(p, free_index, user_page_va, new_page);
+        update_page_in_pte(p->pagetable, user_page_va, (uint64) new_page, free_index);
+        swap_file_trim(p);
         return 1;
     }
     // else memory is full & swapping is needed
     else {
-        int out_index = get_swap_out_page_index(); // select page to swap to file
+        int out_index;
+        if (get_swap_out_pages(&out_index, 1) != 1)
+            panic("get_page_from_file: no page to swap out");
         struct page_metadata_struct out_page = p->memory_pages[out_index];
-        // insert new page into memory
-        update_page_in_pte(p->pagetable, user_page_va, (uint64) new_page, out_index);
+        // read the new page into the victim's slot first: with a full
+        // swap file, that frees the file entry the victim goes to.
         read_page_from_file(p, out_index, user_page_va, new_page);
-        // write page to file
-        write_page_to_file(p, out_page.user_page_VA, p->pagetable);
-        update_page_out_pte(p->pagetable, out_page.user_page_VA);
-        // free physical memory
-        pte_t *pte = walk(p->pagetable, out_page.user_page_VA, 0);
-        uint64 out_page_pa = PTE2PA(*pte);
-        if (out_page_pa != 0)
-            kfree((void *) out_page_pa); // free swapped page
+        update_page_in_pte(p->pagetable, user_page_va, (uint64) new_page, out_index);
+        evict_pages(p->pagetable, &out_page, 1);
         return 1;
     }
 }
 
 int page_in_file(uint64 user_page_va, pagetable_t pagetable) {
+    pte_t *pte;
 
-    pte_t *pte = walk(pagetable, user_page_va, 0);
+    if (user_page_va >= MAXVA || (pte = walk(pagetable, user_page_va, 0)) == 0)
+        return 0;
     int found = (*pte & PTE_PG); // if return 1 page is in file
     return found;
 }
@@ -597,7 +854,7 @@ int page_in_file(uint64 user_page_va, pagetable_t pagetable) {
 // This must use user_page_va + pagetable addresses!
 // The proc has identical user_page_va on different page directories until exec finish executing
 void remove_from_memory_meta_data(uint64 user_page_va, pagetable_t pagetable) {
-    struct proc *p = myproc();
+    struct proc *p = myvm();
     for (int i = 0; i < MAX_PYSC_PAGES; i++) {
         if (p->memory_pages[i].state == P_USED && p->memory_pages[i].user_page_VA == user_page_va &&
             p->pagetable == pagetable) {
@@ -605,13 +862,17 @@ void remove_from_memory_meta_data(uint64 user_page_va, pagetable_t pagetable) {
             p->memory_pages[i].page_order = 0;
             p->pages_in_memory_counter--;
             p->memory_pages[i].state = P_UNUSED;
+            if (p->memory_pages[i].swap) {
+                swap_slot_put(p->memory_pages[i].swap, p->memory_pages[i].slot);
+                p->memory_pages[i].swap = 0;
+            }
             return;
         }
     }
 }
 
 void remove_from_file_meta_data(uint64 user_page_va, pagetable_t pagetable) {
-    struct proc *p = myproc();
+    struct proc *p = myvm();
     for (int i = 0; i < MAX_TOTAL_PAGES - MAX_PYSC_PAGES; i++) {
         if (p->file_pages[i].state == P_USED
             && p->file_pages[i].user_page_VA == user_page_va && p->pagetable == pagetable) {
@@ -619,6 +880,8 @@ void remove_from_file_meta_data(uint64 user_page_va, pagetable_t pagetable) {
             p->file_pages[i].page_order = 0;
             p->pages_in_file_counter--;
             p->file_pages[i].state = P_UNUSED;
+            swap_slot_put(p->file_pages[i].swap, p->file_pages[i].slot);
+            p->file_pages[i].swap = 0;
             return;
         }
     }
@@ -627,21 +890,61 @@ void remove_from_file_meta_data(uint64 user_page_va, pagetable_t pagetable) {
 
 //#if defined(NFUA) || defined(LAPA)
 // Updates the access counter in NFUA and LAPA paging policies
+// Age p's resident pages: shift each access counter right and
+// move the page's PTE_A into its top bit. Pages under one leaf
+// page-table page (2MB of address space) share a single walk.
 void update_access_counter(struct proc *p) {
     uint addr = 0x80000000; // 10000000000000000000000000000000 in binary
+    pte_t *leaf = 0;
+    uint64 leaf_va = 0;
     for (int i = 0; i < MAX_PYSC_PAGES; i++) {
         if (p->memory_pages[i].state == P_USED) {
+            uint64 va = p->memory_pages[i].user_page_VA;
             p->memory_pages[i].access_count >>= 1; // Shift-right
-            pte_t *pte = walk(p->pagetable, p->memory_pages[i].user_page_VA, 0);
+            if (leaf == 0 || (va >> PXSHIFT(1)) != leaf_va) {
+                leaf = walk(p->pagetable, va, 0) - PX(0, va);
+                leaf_va = va >> PXSHIFT(1);
+            }
+            pte_t *pte = &leaf[PX(0, va)];
             if (*pte & PTE_A) {
                 p->memory_pages[i].access_count |= addr; // add 1 to the most significant bit
-                *pte &= ~PTE_A; // turn off PTE_A flag
+                __sync_fetch_and_and(pte, ~PTE_A); // turn off PTE_A flag
+                // a cached translation would hide the next access.
+                tlb_flush(p, p->memory_pages[i].user_page_VA, 1);
             }
         }
     }
 }
 //#endif
 
+// Called on each trap from user space: run the aging sweep
+// once the address space's threads have run for AGING_PERIOD
+// together since the last one, so its cost follows run time
+// rather than the context-switch rate. Each thread adds the
+// run time it hasn't added yet (p->aged) to its leader's clock.
+void
+page_aging(struct proc *p) {
+#if defined(NFUA) || defined(LAPA)
+    struct proc *vm = p->leader;
+    uint64 now = p->utime + p->stime;
+    int due;
+
+    if (vm->pid <= 2)
+        return;
+    acquire(&vm->vmlk);
+    vm->agetime += now - p->aged;
+    if ((due = vm->agetime >= AGING_PERIOD))
+        vm->agetime = 0;
+    release(&vm->vmlk);
+    p->aged = now;
+    if (due) {
+        vmlock(vm);
+        update_access_counter(vm);
+        vmunlock(vm);
+    }
+#endif
+}
+
 // Counts the number of turned on bits
 uint num_of_ones(uint access_count) {
     int num_of_ones = 0;
@@ -653,39 +956,47 @@ uint num_of_ones(uint access_count) {
     return num_of_ones;
 }
 
+// The algorithms below pass over memory pages whose bit is set
+// in skip, so that several victims can be chosen in one pass.
+
 // Second Chance FIFO - Page Replacement Algorithm
-int SCFIFO_algorithm() {
-    struct proc *p = myproc();
+int SCFIFO_algorithm(uint skip) {
+    struct proc *p = myvm();
     int page_index;
     uint64 page_order;
     recheck:
     page_index = -1;
     page_order = 0xffffffff;
     for (int i = 0; i < MAX_PYSC_PAGES; i++) {
-        if (p->memory_pages[i].state == P_USED && p->memory_pages[i].page_order <= page_order) {
+        if (p->memory_pages[i].state == P_USED && !(skip & (1 << i)) &&
+            p->memory_pages[i].page_order <= page_order) {
             page_index = i;
             page_order = p->memory_pages[i].page_order;
         }
     }
+    if (page_index < 0)
+        return -1;
     pte_t *pte = walk(p->pagetable, p->memory_pages[page_index].user_page_VA, 0);
     if (*pte & PTE_A) {
-        *pte &= ~PTE_A; // turn off PTE_A flag
+        __sync_fetch_and_and(pte, ~PTE_A); // turn off PTE_A flag
+        tlb_flush(p, p->memory_pages[page_index].user_page_VA, 1);
         p->memory_pages[page_index].page_order = p->page_order_counter++; // put this page to the end of the queue
+        p->pgstat.scanned += MAX_PYSC_PAGES; // one more pass
         goto recheck;
     }
     return page_index;
 }
 
 // Not Frequently Used With Aging Page Replacement Algorithm
-int NFUA_algorithm() {
-    struct proc *p = myproc();
+int NFUA_algorithm(uint skip) {
+    struct proc *p = myvm();
     int page_index = -1;
     uint best = 0xFFFFFFFF;
     uint curr = 0xFFFFFFFF;
     for (int i = 0; i < MAX_PYSC_PAGES; i++) {
-        if (p->memory_pages[i].state == P_USED) {
+        if (p->memory_pages[i].state == P_USED && !(skip & (1 << i))) {
             curr = p->memory_pages[i].access_count;
-            if (curr < best) {
+            if (curr < best || page_index < 0) {
                 best = curr;
                 page_index = i;
             }
@@ -695,15 +1006,15 @@ int NFUA_algorithm() {
 }
 
 // Least Accessed Page With Aging Page Replacement Algorithm
-int LAPA_algorithm() {
-    struct proc *p = myproc();
+int LAPA_algorithm(uint skip) {
+    struct proc *p = myvm();
     int page_index = -1;
     uint best = 0xFFFFFFFF;
     uint curr = 0xFFFFFFFF;
     for (int i = 0; i < MAX_PYSC_PAGES; i++) {
-        if (p->memory_pages[i].state == P_USED) {
+        if (p->memory_pages[i].state == P_USED && !(skip & (1 << i))) {
             curr = num_of_ones(p->memory_pages[i].access_count);
-            if (curr < best ||
+            if (page_index < 0 || curr < best ||
                 (curr == best && p->memory_pages[i].access_count < p->memory_pages[page_index].access_count)) {
                 best = curr;
                 page_index = i;
@@ -714,30 +1025,61 @@ int LAPA_algorithm() {
 }
 
 // for debug always try to swap the first page
-int first_only_algorithm() {
-    return 0;
+int first_only_algorithm(uint skip) {
+    for (int i = 0; i < MAX_PYSC_PAGES; i++) {
+        if (myvm()->memory_pages[i].state == P_USED && !(skip & (1 << i)))
+            return i;
+    }
+    return -1;
 }
 
-int get_swap_out_page_index() {
-    // update the access counter before using swap algorithm in order to update AGING data
-#if defined(NFUA) || defined(LAPA)
-    update_access_counter(myproc());
-#endif
+static int
+pick_swap_out_page(uint skip) {
 #ifdef SCFIFO
-    return SCFIFO_algorithm();
+    return SCFIFO_algorithm(skip);
 #endif
 #ifdef LAPA
-    return LAPA_algorithm();
+    return LAPA_algorithm(skip);
 #endif
 #ifdef NFUA
-    return NFUA_algorithm();
+    return NFUA_algorithm(skip);
 #endif
 #ifdef DEBUG
-    return first_only_algorithm();
+    return first_only_algorithm(skip);
 #endif
     panic("Unrecognized paging machanism");
 }
 
+// Choose up to k distinct pages to swap out, in one pass of the
+// paging policy: AGING data is updated once, then the policy is
+// asked for k victims. Their memory_pages indices go in victims[].
+// Returns the number of victims found.
+int get_swap_out_pages(int *victims, int k) {
+    struct proc *p = myvm();
+    uint skip = 0;
+    int n, i;
+    // update the access counter before using swap algorithm in order to update AGING data
+#if defined(NFUA) || defined(LAPA)
+    update_access_counter(p);
+#endif
+    for (n = 0; n < k; n++) {
+        p->pgstat.scans++;
+        p->pgstat.scanned += MAX_PYSC_PAGES;
+        if ((i = pick_swap_out_page(skip)) < 0)
+            break;
+        victims[n] = i;
+        skip |= 1 << i;
+    }
+    return n;
+}
+
+int get_swap_out_page_index() {
+    int index;
+    if (get_swap_out_pages(&index, 1) != 1)
+        return -1;
+    return index;
+}
+
 void print_memory_metadata_state(struct proc *p) {
     if (p->pid > 2) {
         printf("PID: %d num of pages in MEM: %d\n", p->pid, p->pages_in_memory_counter);
@@ -756,6 +1098,9 @@ void print_memory_metadata_state(struct proc *p) {
 //                       p->memory_pages[i].user_page_VA,p->memory_pages[i].access_count,p->memory_pages[i].page_order);
 //            }
         }
+        if (p->swap)
+            printf("swap file: %d slots on disk, used up to slot %d, %d holes\n",
+                   p->swap->backed, swap_slots_top(p->swap), swap_fragmentation(p->swap));
         printf("########### file PAGES ###########\n");
         for (int i = 0; i < 16; i++) {
             if (p->file_pages[i].state == P_USED) {
@@ -0,0 +1,25 @@
+// Print the buffer cache's size and hit ratio.
+// bcstat n first sets the most buffers it may grow to.
+
+#include "kernel/types.h"
+#include "kernel/bcachestat.h"
+#include "user/user.h"
+
+int
+main(int argc, char *argv[])
+{
+  struct bcachestat st;
+  uint64 lookups;
+
+  if(bcachestat(&st, argc > 1 ? atoi(argv[1]) : 0) < 0){
+    fprintf(2, "bcstat: bcachestat failed\n");
+    exit(1);
+  }
+  lookups = st.hits + st.misses;
+  printf("%d buffers (max %d), %d pages added, %d given back\n",
+         st.nbuf, st.max, st.grows, st.shrinks);
+  printf("%l hits, %l misses, hit ratio %l%%\n", st.hits, st.misses,
+         lookups ? st.hits * 100 / lookups : 0);
+  printf("%l blocks read ahead\n", st.readaheads);
+  exit(0);
+}
@@ -0,0 +1,98 @@
+// Lock fairness benchmark: 1, 2, 4 and 8 processes hammer a
+// kernel test-and-set lock, then a ticket lock, through
+// lockbench(); print percentiles of how long an acquire
+// waited, in timer cycles (rounded up to a power of two).
+// Run with at least as many harts as processes (CPUS=8).
+
+#include "kernel/types.h"
+#include "kernel/lockstat.h"
+#include "user/user.h"
+
+#define N 20000
+#define MAXPROC 8
+
+// The smallest power of two at least as large as fraction
+// num/den of the waits in hist.
+uint
+percentile(uint *hist, uint total, int num, int den)
+{
+  uint64 need = ((uint64)total * num + den - 1) / den;
+  uint64 seen = 0;
+
+  for(int b = 0; b < NLOCKBENCH; b++){
+    seen += hist[b];
+    if(seen >= need)
+      return b == 0 ? 0 : 1U << b;
+  }
+  return 1U << (NLOCKBENCH - 1);
+}
+
+void
+run(int fair, int nproc)
+{
+  uint hist[NLOCKBENCH], sum[NLOCKBENCH];
+  int go[2], out[MAXPROC][2];
+  char c;
+  int i, b;
+  uint total;
+
+  if(pipe(go) < 0){
+    fprintf(2, "lockbench: pipe failed\n");
+    exit(1);
+  }
+  for(i = 0; i < nproc; i++){
+    // one result pipe each, so that results don't interleave.
+    if(pipe(out[i]) < 0){
+      fprintf(2, "lockbench: pipe failed\n");
+      exit(1);
+    }
+    int pid = fork();
+    if(pid < 0){
+      fprintf(2, "lockbench: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      close(go[1]);
+      // start together
+      read(go[0], &c, 1);
+      if(lockbench(fair, N, hist) < 0)
+        exit(1);
+      write(out[i][1], hist, sizeof(hist));
+      exit(0);
+    }
+    close(out[i][1]);
+  }
+  close(go[0]);
+  for(i = 0; i < nproc; i++)
+    write(go[1], "g", 1);
+  close(go[1]);
+
+  memset(sum, 0, sizeof(sum));
+  for(i = 0; i < nproc; i++){
+    if(read(out[i][0], hist, sizeof(hist)) != sizeof(hist)){
+      fprintf(2, "lockbench: lost a result\n");
+      exit(1);
+    }
+    close(out[i][0]);
+    for(b = 0; b < NLOCKBENCH; b++)
+      sum[b] += hist[b];
+  }
+  for(i = 0; i < nproc; i++)
+    wait(0);
+
+  total = nproc * N;
+  printf("%s %d procs: p50 %d p99 %d p99.9 %d max %d\n",
+         fair ? "ticket" : "tas   ", nproc,
+         percentile(sum, total, 1, 2), percentile(sum, total, 99, 100),
+         percentile(sum, total, 999, 1000), percentile(sum, total, 1, 1));
+}
+
+int
+main(int argc, char *argv[])
+{
+  for(int fair = 0; fair < 2; fair++){
+    for(int nproc = 1; nproc <= MAXPROC; nproc *= 2)
+      run(fair, nproc);
+  }
+  exit(0);
+}
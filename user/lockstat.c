@@ -0,0 +1,37 @@
+// Print the kernel's lock statistics, most contended first.
+// lockstat -r clears them afterwards.
+
+#include "kernel/types.h"
+#include "kernel/param.h"
+#include "kernel/lockstat.h"
+#include "user/user.h"
+
+struct lockinfo info[NLOCKSTAT];
+
+int
+main(int argc, char **argv)
+{
+  struct lockinfo t;
+  int i, j, n, reset;
+
+  reset = argc > 1 && strcmp(argv[1], "-r") == 0;
+  if((n = lockstat(info, NLOCKSTAT, reset)) < 0){
+    fprintf(2, "lockstat: kernel not built with LOCKSTAT=1\n");
+    exit(1);
+  }
+  for(i = 1; i < n; i++){
+    t = info[i];
+    for(j = i; j > 0 && info[j-1].contended < t.contended; j--)
+      info[j] = info[j-1];
+    info[j] = t;
+  }
+  printf("name             locks acquires contended wait maxhold\n");
+  for(i = 0; i < n; i++){
+    if(info[i].acquires == 0)
+      continue;
+    printf("%s%s %d %l %l %l %l\n", info[i].name, info[i].sleep ? " (sleep)" : "",
+           info[i].nlocks, info[i].acquires, info[i].contended,
+           info[i].waittime, info[i].maxhold);
+  }
+  exit(0);
+}
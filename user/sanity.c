@@ -7,6 +7,7 @@
 #include "kernel/syscall.h"
 #include "kernel/memlayout.h"
 #include "kernel/riscv.h"
+#include "kernel/pagestat.h"
 
 #define PGSIZE 4096
 
@@ -111,6 +112,20 @@ void page_faults_test() {
 //    }
 //    free(arr);
     printf("Num of page faults: %d \n", page_fault_num());
+    struct pagestat st;
+    if (pagestat(getpid(), &st) < 0) {
+        printf("pagestat failed\n");
+        exit(1);
+    }
+    if (st.faults != page_fault_num() || st.pageins > st.faults) {
+        printf("pagestat: bad fault counts\n");
+        exit(1);
+    }
+    printf("policy %d: %d resident, %d swapped, %d page-ins, %d page-outs (%d clean)\n",
+           st.policy, st.resident, st.swapped, st.pageins, st.pageouts, st.cleanouts);
+    printf("swap: %d KB read, %d KB written, %d ticks; %d slots, %d holes; %d scans of %d pages\n",
+           (int) (st.readbytes / 1024), (int) (st.writebytes / 1024), st.ioticks,
+           st.swapslots, st.swapholes, st.scans, st.scanned);
     printf("--------- page_faults_test finished ---------\n");
 }
 
@@ -125,6 +140,81 @@ void exec_page_faults_test() {
     }
 }
 
+#define NTHR 3
+#define THR_PAGES 12
+
+char *thr_pages;
+char thr_stacks[NTHR][PGSIZE];
+struct mutex thr_lock;
+struct cond thr_cond;
+int thr_done;
+
+void thread_body(void *arg) {
+    int id = (int) (uint64) arg;
+    // the threads fault on the same pages and evict each other's.
+    for (int round = 0; round < 4; round++) {
+        for (int i = id; i < THR_PAGES; i += NTHR)
+            thr_pages[i * PGSIZE + round] = 'a' + id;
+        for (int i = 0; i < THR_PAGES; i++)
+            (void) *(volatile char *) &thr_pages[i * PGSIZE];
+    }
+    mutex_lock(&thr_lock);
+    thr_done++;
+    cond_signal(&thr_cond);
+    mutex_unlock(&thr_lock);
+    exit(0);
+}
+
+void threads_test() {
+    printf("--------- threads_test starting ---------\n");
+    thr_pages = sbrk(THR_PAGES * PGSIZE);
+    for (int i = 0; i < NTHR; i++) {
+        if (clone(thread_body, (void *) (uint64) i, thr_stacks[i] + PGSIZE) < 0) {
+            printf("clone failed\n");
+            exit(1);
+        }
+    }
+    mutex_lock(&thr_lock);
+    while (thr_done < NTHR)
+        cond_wait(&thr_cond, &thr_lock);
+    mutex_unlock(&thr_lock);
+    for (int i = 0; i < NTHR; i++)
+        wait(0);
+    for (int i = 0; i < THR_PAGES; i++) {
+        for (int round = 0; round < 4; round++) {
+            if (thr_pages[i * PGSIZE + round] != 'a' + i % NTHR) {
+                printf("threads_test: page %d lost a write\n", i);
+                exit(1);
+            }
+        }
+    }
+    // the kernel copies to and from pages that may be in swap.
+    int fds[2];
+    if (pipe(fds) < 0) {
+        printf("pipe failed\n");
+        exit(1);
+    }
+    for (int i = 0; i < THR_PAGES; i++) {
+        char *to = &thr_pages[(i + 1) % THR_PAGES * PGSIZE + 8];
+        if (write(fds[1], &thr_pages[i * PGSIZE], 4) != 4 || read(fds[0], to, 4) != 4 ||
+            memcmp(to, &thr_pages[i * PGSIZE], 4) != 0) {
+            printf("threads_test: pipe I/O on page %d failed\n", i);
+            exit(1);
+        }
+    }
+    close(fds[0]);
+    close(fds[1]);
+    printf("Num of page faults: %d \n", page_fault_num());
+    printf("--------- threads_test finished ---------\n");
+}
+
+void exec_threads_test() {
+    if (fork() == 0) {
+        char *argv[] = {"sanity", "threads_test", 0};
+        exec(argv[0], argv);
+    }
+    wait(0);
+}
 
 int main(int argc, char *argv[]) {
     if (argc >= 1 && strcmp(argv[1], "exec_child_test") == 0) {
@@ -135,9 +225,14 @@ int main(int argc, char *argv[]) {
         page_faults_test();
         exit(0);
     }
+    if (argc >= 1 && strcmp(argv[1], "threads_test") == 0) {
+        threads_test();
+        exit(0);
+    }
     exec_test();
     fork_test();
     alloc_dealloc_test();
     exec_page_faults_test();  // should be run with exec on a "clean" process
+    exec_threads_test();
     exit(0);
 }
@@ -1,5 +1,18 @@
 struct stat;
 struct rtcdate;
+struct pagestat;
+struct rusage;
+struct lockinfo;
+struct bcachestat;
+
+// ulib.c locks, for the threads of a process; all zero is
+// unlocked. See mutex_lock().
+struct mutex {
+  int state;  // 0 unlocked, 1 locked, 2 locked with waiters
+};
+struct cond {
+  int seq;    // bumped by every signal
+};
 
 // system calls
 int fork(void);
@@ -24,6 +37,15 @@ char* sbrk(int);
 int sleep(int);
 int uptime(void);
 int page_fault_num(void);
+int pagestat(int, struct pagestat*);
+int nanosleep(uint64);
+int getrusage(int, struct rusage*);
+int quantum(int);
+int clone(void (*)(void*), void*, void*);
+int futex(int*, int, int);
+int lockstat(struct lockinfo*, int, int);
+int lockbench(int, int, uint*);
+int bcachestat(struct bcachestat*, int);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -41,3 +63,10 @@ void free(void*);
 int atoi(const char*);
 int memcmp(const void *, const void *, uint);
 void *memcpy(void *, const void *, uint);
+void mutex_init(struct mutex*);
+void mutex_lock(struct mutex*);
+void mutex_unlock(struct mutex*);
+void cond_init(struct cond*);
+void cond_wait(struct cond*, struct mutex*);
+void cond_signal(struct cond*);
+void cond_broadcast(struct cond*);
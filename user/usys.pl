@@ -37,3 +37,12 @@ entry("sbrk");
 entry("sleep");
 entry("uptime");
 entry("page_fault_num");
+entry("pagestat");
+entry("nanosleep");
+entry("getrusage");
+entry("quantum");
+entry("clone");
+entry("futex");
+entry("lockstat");
+entry("lockbench");
+entry("bcachestat");